@@ -0,0 +1,307 @@
+#ifndef HUNT_DISTANCE_H
+#define HUNT_DISTANCE_H
+
+// Bulk great-circle distances from one point to every treasure of a hunt,
+// used by treasure_manager's "nearest" query and "bench_distance".
+//
+// The coordinates are copied into a structure of arrays of unit vectors
+// (x, y, z). The haversine term is a quarter of the squared chord between
+// two unit vectors, so the per-treasure work is three subtractions, a dot
+// product and a square root; the arcsine is a polynomial. That leaves no
+// libm call in the loop, and four (AVX2) or two (SSE2) treasures are
+// handled per instruction. The kernel is chosen at run time from what the
+// CPU supports; other architectures use the scalar loop.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "treasure_store.h"
+#include "hunt_spatial.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HUNT_DISTANCE_X86 1
+#endif
+
+// Live treasures of a hunt as unit vectors, with their IDs and record offsets
+typedef struct
+{
+    double *x;
+    double *y;
+    double *z;
+    int *ids;
+    uint64_t *offsets;
+    size_t count;
+} HuntCoordinates;
+
+typedef enum
+{
+    DISTANCE_KERNEL_SCALAR,
+    DISTANCE_KERNEL_SSE2,
+    DISTANCE_KERNEL_AVX2
+} DistanceKernel;
+
+// Taylor coefficients of asin(r) / r in r^2: (2n)! / (4^n (n!)^2 (2n + 1)).
+// Arguments are reduced to r <= 0.5, where 16 terms are exact to ~1e-12.
+static const double distance_asin_coefficients[16] = {
+    1,
+    0.16666666666666666,
+    0.074999999999999997,
+    0.044642857142857144,
+    0.030381944444444444,
+    0.022372159090909092,
+    0.017352764423076924,
+    0.013964843750000001,
+    0.011551800896139705,
+    0.0097616095291940784,
+    0.0083903358096168151,
+    0.0073125258735988454,
+    0.0064472103118896487,
+    0.0057400376708419236,
+    0.0051533096823199046,
+    0.0046601434869150962,
+};
+
+static inline void distance_unit_vector(double latitude, double longitude, double *v)
+{
+    const double to_rad = M_PI / 180.0;
+    v[0] = cos(latitude * to_rad) * cos(longitude * to_rad);
+    v[1] = cos(latitude * to_rad) * sin(longitude * to_rad);
+    v[2] = sin(latitude * to_rad);
+}
+
+static inline void hunt_coordinates_free(HuntCoordinates *coords)
+{
+    free(coords->x);
+    free(coords->y);
+    free(coords->z);
+    free(coords->ids);
+    free(coords->offsets);
+    memset(coords, 0, sizeof(*coords));
+}
+
+// Copy the live treasures of a view into coords.
+// Returns 0 on success, -1 if memory ran out.
+static inline int hunt_coordinates_build(const TreasureView *view, HuntCoordinates *coords)
+{
+    memset(coords, 0, sizeof(*coords));
+    size_t capacity = view->live_count > 0 ? (size_t)view->live_count : 1;
+    coords->x = malloc(capacity * sizeof(double));
+    coords->y = malloc(capacity * sizeof(double));
+    coords->z = malloc(capacity * sizeof(double));
+    coords->ids = malloc(capacity * sizeof(int));
+    coords->offsets = malloc(capacity * sizeof(uint64_t));
+    if (!coords->x || !coords->y || !coords->z || !coords->ids || !coords->offsets)
+    {
+        hunt_coordinates_free(coords);
+        return -1;
+    }
+
+    TreasureCursor cursor;
+    Treasure t;
+    treasure_cursor_init(view, &cursor);
+    while (coords->count < capacity && treasure_view_next(view, &cursor, &t))
+    {
+        double v[3];
+        distance_unit_vector(t.latitude, t.longitude, v);
+        coords->x[coords->count] = v[0];
+        coords->y[coords->count] = v[1];
+        coords->z[coords->count] = v[2];
+        coords->ids[coords->count] = t.id;
+        coords->offsets[coords->count] = cursor.record_offset;
+        coords->count++;
+    }
+    return 0;
+}
+
+// Distance in meters for half the chord length h between two unit vectors
+static inline double distance_of_half_chord(double h)
+{
+    return 2 * EARTH_RADIUS_M * asin(h < 1 ? h : 1);
+}
+
+// Portable kernel: out[i] = distance from (latitude, longitude) to treasure i
+static inline void hunt_distances_scalar(const HuntCoordinates *coords, double latitude, double longitude,
+                                         double *out)
+{
+    double p[3];
+    distance_unit_vector(latitude, longitude, p);
+    for (size_t i = 0; i < coords->count; i++)
+    {
+        double dx = coords->x[i] - p[0];
+        double dy = coords->y[i] - p[1];
+        double dz = coords->z[i] - p[2];
+        out[i] = distance_of_half_chord(0.5 * sqrt(dx * dx + dy * dy + dz * dz));
+    }
+}
+
+#ifdef HUNT_DISTANCE_X86
+__attribute__((target("sse2"))) static inline void hunt_distances_sse2(const HuntCoordinates *coords,
+                                                                      double latitude, double longitude,
+                                                                      double *out)
+{
+    double p[3];
+    distance_unit_vector(latitude, longitude, p);
+    const __m128d px = _mm_set1_pd(p[0]), py = _mm_set1_pd(p[1]), pz = _mm_set1_pd(p[2]);
+    const __m128d half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0), two = _mm_set1_pd(2.0);
+    const __m128d half_pi = _mm_set1_pd(M_PI / 2), scale = _mm_set1_pd(2 * EARTH_RADIUS_M);
+
+    size_t i = 0;
+    for (; i + 2 <= coords->count; i += 2)
+    {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(coords->x + i), px);
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(coords->y + i), py);
+        __m128d dz = _mm_sub_pd(_mm_loadu_pd(coords->z + i), pz);
+        __m128d chord2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+        __m128d h = _mm_min_pd(_mm_mul_pd(half, _mm_sqrt_pd(chord2)), one);
+
+        // asin(h) = pi/2 - 2 asin(sqrt((1 - h) / 2)) above 0.5
+        __m128d big = _mm_cmpgt_pd(h, half);
+        __m128d reduced = _mm_sqrt_pd(_mm_mul_pd(_mm_sub_pd(one, h), half));
+        __m128d r = _mm_or_pd(_mm_and_pd(big, reduced), _mm_andnot_pd(big, h));
+        __m128d s = _mm_mul_pd(r, r);
+        __m128d poly = _mm_set1_pd(distance_asin_coefficients[15]);
+        for (int c = 14; c >= 0; c--)
+        {
+            poly = _mm_add_pd(_mm_mul_pd(poly, s), _mm_set1_pd(distance_asin_coefficients[c]));
+        }
+        poly = _mm_mul_pd(poly, r);
+        __m128d unreduced = _mm_sub_pd(half_pi, _mm_mul_pd(two, poly));
+        __m128d angle = _mm_or_pd(_mm_and_pd(big, unreduced), _mm_andnot_pd(big, poly));
+        _mm_storeu_pd(out + i, _mm_mul_pd(scale, angle));
+    }
+    for (; i < coords->count; i++)
+    {
+        double dx = coords->x[i] - p[0];
+        double dy = coords->y[i] - p[1];
+        double dz = coords->z[i] - p[2];
+        out[i] = distance_of_half_chord(0.5 * sqrt(dx * dx + dy * dy + dz * dz));
+    }
+}
+
+__attribute__((target("avx2,fma"))) static inline void hunt_distances_avx2(const HuntCoordinates *coords,
+                                                                          double latitude, double longitude,
+                                                                          double *out)
+{
+    double p[3];
+    distance_unit_vector(latitude, longitude, p);
+    const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+    const __m256d half = _mm256_set1_pd(0.5), one = _mm256_set1_pd(1.0), minus_two = _mm256_set1_pd(-2.0);
+    const __m256d half_pi = _mm256_set1_pd(M_PI / 2), scale = _mm256_set1_pd(2 * EARTH_RADIUS_M);
+
+    size_t i = 0;
+    for (; i + 4 <= coords->count; i += 4)
+    {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(coords->x + i), px);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(coords->y + i), py);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(coords->z + i), pz);
+        __m256d chord2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+        __m256d h = _mm256_min_pd(_mm256_mul_pd(half, _mm256_sqrt_pd(chord2)), one);
+
+        // asin(h) = pi/2 - 2 asin(sqrt((1 - h) / 2)) above 0.5
+        __m256d big = _mm256_cmp_pd(h, half, _CMP_GT_OQ);
+        __m256d reduced = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_sub_pd(one, h), half));
+        __m256d r = _mm256_blendv_pd(h, reduced, big);
+        __m256d s = _mm256_mul_pd(r, r);
+        __m256d poly = _mm256_set1_pd(distance_asin_coefficients[15]);
+        for (int c = 14; c >= 0; c--)
+        {
+            poly = _mm256_fmadd_pd(poly, s, _mm256_set1_pd(distance_asin_coefficients[c]));
+        }
+        poly = _mm256_mul_pd(poly, r);
+        __m256d angle = _mm256_blendv_pd(poly, _mm256_fmadd_pd(minus_two, poly, half_pi), big);
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(scale, angle));
+    }
+    for (; i < coords->count; i++)
+    {
+        double dx = coords->x[i] - p[0];
+        double dy = coords->y[i] - p[1];
+        double dz = coords->z[i] - p[2];
+        out[i] = distance_of_half_chord(0.5 * sqrt(dx * dx + dy * dy + dz * dz));
+    }
+}
+#endif
+
+// Whether this CPU can run a kernel
+static inline int distance_kernel_supported(DistanceKernel kernel)
+{
+#ifdef HUNT_DISTANCE_X86
+    __builtin_cpu_init();
+    switch (kernel)
+    {
+    case DISTANCE_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case DISTANCE_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    default:
+        return 1;
+    }
+#else
+    return kernel == DISTANCE_KERNEL_SCALAR;
+#endif
+}
+
+static inline const char *distance_kernel_name(DistanceKernel kernel)
+{
+    switch (kernel)
+    {
+    case DISTANCE_KERNEL_AVX2:
+        return "avx2";
+    case DISTANCE_KERNEL_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+// Fastest kernel this CPU supports
+static inline DistanceKernel distance_kernel_best()
+{
+    if (distance_kernel_supported(DISTANCE_KERNEL_AVX2))
+    {
+        return DISTANCE_KERNEL_AVX2;
+    }
+    if (distance_kernel_supported(DISTANCE_KERNEL_SSE2))
+    {
+        return DISTANCE_KERNEL_SSE2;
+    }
+    return DISTANCE_KERNEL_SCALAR;
+}
+
+// Run a kernel, which must be supported: out[i] = meters to treasure i
+static inline void hunt_distances_with(DistanceKernel kernel, const HuntCoordinates *coords, double latitude,
+                                       double longitude, double *out)
+{
+    switch (kernel)
+    {
+#ifdef HUNT_DISTANCE_X86
+    case DISTANCE_KERNEL_AVX2:
+        hunt_distances_avx2(coords, latitude, longitude, out);
+        return;
+    case DISTANCE_KERNEL_SSE2:
+        hunt_distances_sse2(coords, latitude, longitude, out);
+        return;
+#endif
+    default:
+        hunt_distances_scalar(coords, latitude, longitude, out);
+        return;
+    }
+}
+
+// out[i] = meters from (latitude, longitude) to treasure i, on the fastest kernel
+static inline void hunt_distances(const HuntCoordinates *coords, double latitude, double longitude, double *out)
+{
+    // Atomic, as monitor workers race to fill it; each computes the same value
+    static int best = -1;
+    int kernel = __atomic_load_n(&best, __ATOMIC_RELAXED);
+    if (kernel < 0)
+    {
+        kernel = (int)distance_kernel_best();
+        __atomic_store_n(&best, kernel, __ATOMIC_RELAXED);
+    }
+    hunt_distances_with((DistanceKernel)kernel, coords, latitude, longitude, out);
+}
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef HUNT_LOG_H
+#define HUNT_LOG_H
+
+// Operation log of a hunt, written by treasure_manager and rendered as
+// text by "log dump" and by the merge into hunt_log.txt.
+//
+// hunt/hunt<ID>/logged_hunt.bin (native byte order):
+//   header:  "TRLG" | uint32 version | uint64 reserved
+//   record:  LogRecordHeader | username bytes | details bytes
+// Records are appended whole with O_APPEND writes, so writers in several
+// processes never interleave. Each record carries its length and a CRC-32
+// of its bytes; a reader stops at the first incomplete or damaged record.
+// Hunts created before this format keep their old logged_hunt.txt, which
+// "log dump" prints ahead of the binary records.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "treasure_store.h"
+
+#define LOG_MAGIC "TRLG"
+#define LOG_FORMAT_VERSION 1
+#define LOG_FILE_NAME "logged_hunt.bin"
+#define LOG_LEGACY_FILE_NAME "logged_hunt.txt"
+#define LOG_MAX_TEXT 512 // Longest username or details stored
+#define LOG_FLAG_FAILED 0x1
+
+typedef enum
+{
+    LOG_OP_ADD = 1,
+    LOG_OP_IMPORT,
+    LOG_OP_LIST,
+    LOG_OP_VIEW,
+    LOG_OP_REMOVE,
+    LOG_OP_COMPACT,
+    LOG_OP_ACCESS
+} LogOp;
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t reserved;
+} LogFileHeader;
+
+// Fixed part of a record. What treasure_id, value and count hold depends
+// on the operation; see log_render().
+typedef struct
+{
+    uint64_t timestamp_ns; // CLOCK_REALTIME
+    uint32_t length;       // Of the whole record
+    uint32_t checksum;     // CRC-32 of the record with this field zeroed
+    uint16_t op;
+    uint16_t flags;
+    uint16_t username_length;
+    uint16_t details_length;
+    int32_t treasure_id;
+    int32_t value;
+    int64_t count;
+} LogRecordHeader;
+
+#define LOG_MAX_RECORD (sizeof(LogRecordHeader) + 2 * LOG_MAX_TEXT)
+
+// An operation to log, as passed to log_operation()
+typedef struct
+{
+    LogOp op;
+    int failed;
+    int treasure_id;   // The treasure, the first one imported, or views not found
+    int value;         // Its value, treasures kept by a compaction, or lists
+    long long count;   // Treasures imported, listed or left; bytes reclaimed; views
+    const char *username;
+    const char *details; // Import file, or the reason of a failure
+} LogEvent;
+
+static inline const char *log_op_name(uint16_t op)
+{
+    static const char *names[] = {"UNKNOWN", "ADD", "IMPORT", "LIST", "VIEW", "REMOVE", "COMPACT", "ACCESS"};
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : names[0];
+}
+
+static inline size_t log_text_length(const char *text)
+{
+    size_t length = text ? strlen(text) : 0;
+    return length > LOG_MAX_TEXT ? LOG_MAX_TEXT : length;
+}
+
+// Bytes log_encode() needs for an event
+static inline size_t log_encoded_size(const LogEvent *event)
+{
+    return sizeof(LogRecordHeader) + log_text_length(event->username) + log_text_length(event->details);
+}
+
+// Encode an event stamped with the current time into out, which needs
+// log_encoded_size() bytes. Returns the record length.
+static inline size_t log_encode(const LogEvent *event, unsigned char *out)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    LogRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    header.op = (uint16_t)event->op;
+    header.flags = event->failed ? LOG_FLAG_FAILED : 0;
+    header.username_length = (uint16_t)log_text_length(event->username);
+    header.details_length = (uint16_t)log_text_length(event->details);
+    header.treasure_id = event->treasure_id;
+    header.value = event->value;
+    header.count = event->count;
+    header.length = (uint32_t)(sizeof(header) + header.username_length + header.details_length);
+
+    memcpy(out + sizeof(header), event->username ? event->username : "", header.username_length);
+    memcpy(out + sizeof(header) + header.username_length, event->details ? event->details : "",
+           header.details_length);
+    memcpy(out, &header, sizeof(header));
+    header.checksum = treasure_crc32(0, out, header.length);
+    memcpy(out, &header, sizeof(header));
+    return header.length;
+}
+
+// Decode the record at the start of buf. Sets the strings (not
+// terminated) to point into buf. Returns the record length, or 0 if avail
+// bytes hold no complete, intact record.
+static inline size_t log_decode(const unsigned char *buf, size_t avail, LogRecordHeader *header,
+                                const char **username, const char **details)
+{
+    if (avail < sizeof(*header))
+    {
+        return 0;
+    }
+    memcpy(header, buf, sizeof(*header));
+    if (header->length != sizeof(*header) + (size_t)header->username_length + header->details_length ||
+        header->length > avail)
+    {
+        return 0;
+    }
+
+    LogRecordHeader zeroed = *header;
+    zeroed.checksum = 0;
+    uint32_t crc = treasure_crc32(0, (const unsigned char *)&zeroed, sizeof(zeroed));
+    crc = treasure_crc32(crc, buf + sizeof(*header), header->length - sizeof(*header));
+    if (crc != header->checksum)
+    {
+        return 0;
+    }
+    *username = (const char *)buf + sizeof(*header);
+    *details = *username + header->username_length;
+    return header->length;
+}
+
+// Render a decoded record as one text line, in the wording of the old
+// text log. Returns the length written to out (truncated to size - 1).
+static inline int log_render(const LogRecordHeader *h, const char *username, const char *details, char *out,
+                             size_t size)
+{
+    time_t seconds = (time_t)(h->timestamp_ns / 1000000000ULL);
+    struct tm local;
+    char when[32];
+    localtime_r(&seconds, &local);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+
+    int user_length = h->username_length, details_length = h->details_length;
+    int failed = (h->flags & LOG_FLAG_FAILED) != 0;
+    char text[LOG_MAX_TEXT * 2 + 128];
+    switch (h->op)
+    {
+    case LOG_OP_ADD:
+        if (failed)
+        {
+            snprintf(text, sizeof(text), "Failed: %.*s", details_length, details);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "Added treasure ID: %d, Username: %.*s, Value: %d", h->treasure_id,
+                     user_length, username, h->value);
+        }
+        break;
+    case LOG_OP_IMPORT:
+        if (failed)
+        {
+            snprintf(text, sizeof(text), "Failed: Could not import %lld treasures from %.*s", (long long)h->count,
+                     details_length, details);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "Imported %lld treasures (IDs %d-%lld) from %.*s", (long long)h->count,
+                     h->treasure_id, (long long)h->treasure_id + h->count - 1, details_length, details);
+        }
+        break;
+    case LOG_OP_LIST:
+        if (h->count == 0)
+        {
+            snprintf(text, sizeof(text), "No treasures found");
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "Listed %lld treasures", (long long)h->count);
+        }
+        break;
+    case LOG_OP_VIEW:
+        if (failed)
+        {
+            snprintf(text, sizeof(text), "Failed to view treasure ID: %d (not found)", h->treasure_id);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "Viewed treasure ID: %d, Username: %.*s", h->treasure_id, user_length,
+                     username);
+        }
+        break;
+    case LOG_OP_REMOVE:
+        if (failed && h->treasure_id == 0)
+        {
+            snprintf(text, sizeof(text), "Failed: No treasures found");
+        }
+        else if (failed)
+        {
+            snprintf(text, sizeof(text), "Failed to remove treasure ID: %d (not found)", h->treasure_id);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "Removed treasure ID: %d. Remaining count: %lld", h->treasure_id,
+                     (long long)h->count);
+        }
+        break;
+    case LOG_OP_COMPACT:
+        snprintf(text, sizeof(text), "Compacted hunt: %d treasures kept, %lld bytes reclaimed", h->value,
+                 (long long)h->count);
+        break;
+    case LOG_OP_ACCESS:
+        snprintf(text, sizeof(text), "Read %d times as a list, %lld as a view (%d not found)", h->value,
+                 (long long)h->count, h->treasure_id);
+        break;
+    default:
+        snprintf(text, sizeof(text), "id=%d value=%d count=%lld", h->treasure_id, h->value, (long long)h->count);
+        break;
+    }
+
+    int length = snprintf(out, size, "[%s.%09llu] %s: %s\n", when,
+                          (unsigned long long)(h->timestamp_ns % 1000000000ULL), log_op_name(h->op), text);
+    return length >= (int)size ? (int)size - 1 : length;
+}
+
+#endif
@@ -0,0 +1,472 @@
+#ifndef HUNT_SCORES_H
+#define HUNT_SCORES_H
+
+// Per-user scores of a hunt, shared by score_calculator, treasure_manager
+// and the monitor's calculate_score command, plus the score table both the
+// hub and the monitor print.
+//
+// hunt/hunt<ID>/scores.dat keeps the scores of a hunt up to date, so they
+// are read instead of recomputed (native byte order):
+//   header:  "TRSC" | uint32 version | uint32 user_count | uint32 source_live_count |
+//            uint64 base_end | uint64 data_end | uint64 source_inode | uint64 source_end
+//   record:  int32 score | int32 treasure_count | uint32 name_len | uint32 reserved |
+//            username bytes + '\0'
+// The user_count records up to base_end are the table, sorted by username.
+// Adds and removes append delta records (the change of one user's score and
+// count) up to data_end; readers add them to the table. source_* are the
+// inode, data_end and live_count of treasures.dat the scores describe. Every
+// write changes one of them, so a table that missed a write is detected as
+// stale and rebuilt.
+
+#include <stdio.h>
+
+#include "treasure_store.h"
+
+#define SCORE_MAGIC "TRSC"
+#define SCORE_FORMAT_VERSION 1
+
+typedef struct
+{
+    const char *username; // Points into the mapped treasure file
+    int total_score;
+    int treasure_count;
+    uint32_t hash;        // Hash of username, kept for lookups and rehashing
+    uint32_t length;      // strlen(username)
+} UserScore;
+
+// Scores of one hunt. The usernames stay valid while the view is mapped;
+// each distinct name is kept once, pointing at its first occurrence.
+typedef struct
+{
+    UserScore *users;
+    int user_count;
+    int user_capacity;
+    int *slots;         // Open addressing table of indexes into users, -1 = empty
+    uint32_t slot_mask; // Table size - 1, the size is a power of two
+} HuntScores;
+
+// FNV-1a hash of a NUL terminated string, also returning its length
+static inline uint32_t hunt_scores_hash(const char *s, uint32_t *length)
+{
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *)s;
+    while (*p)
+    {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    *length = (uint32_t)(p - (const unsigned char *)s);
+    return hash;
+}
+
+// Header of scores.dat
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t user_count;
+    uint32_t source_live_count;
+    uint64_t base_end;
+    uint64_t data_end;
+    uint64_t source_inode;
+    uint64_t source_end;
+} ScoreFileHeader;
+
+// Fixed part of a scores.dat record, followed by name_len + 1 bytes of username
+typedef struct
+{
+    int32_t score;
+    int32_t treasure_count;
+    uint32_t name_len;
+    uint32_t reserved;
+} ScoreRecord;
+
+// Identity of the treasure file contents a score table describes
+typedef struct
+{
+    uint64_t inode;
+    uint64_t end;        // data_end of treasures.dat
+    uint32_t live_count;
+} ScoreSource;
+
+// scores.dat read into memory; the usernames in scores point into data
+typedef struct
+{
+    unsigned char *data;
+    size_t size;
+    ScoreFileHeader header;
+    HuntScores scores;
+} ScoreFile;
+
+// Rebuild the slot table with room for twice as many users
+static inline int hunt_scores_grow_slots(HuntScores *scores)
+{
+    uint32_t size = scores->slots ? (scores->slot_mask + 1) * 2 : 64;
+    int *slots = malloc(size * sizeof(int));
+    if (!slots)
+    {
+        return -1;
+    }
+    memset(slots, 0xff, size * sizeof(int));
+    for (int i = 0; i < scores->user_count; i++)
+    {
+        uint32_t slot = scores->users[i].hash & (size - 1);
+        while (slots[slot] != -1)
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+        slots[slot] = i;
+    }
+    free(scores->slots);
+    scores->slots = slots;
+    scores->slot_mask = size - 1;
+    return 0;
+}
+
+static inline void hunt_scores_free(HuntScores *scores)
+{
+    free(scores->users);
+    free(scores->slots);
+    memset(scores, 0, sizeof(*scores));
+}
+
+// Start an empty score table. Returns 0 on success, -1 if memory ran out.
+static inline int hunt_scores_init(HuntScores *scores)
+{
+    memset(scores, 0, sizeof(*scores));
+    return hunt_scores_grow_slots(scores);
+}
+
+// Find the user named username (length bytes, hashed to hash). Returns its
+// index, or -1 with *slot set to where it would be inserted.
+static inline int hunt_scores_find(const HuntScores *scores, const char *username, uint32_t length,
+                                   uint32_t hash, uint32_t *slot)
+{
+    uint32_t i = hash & scores->slot_mask;
+    int index;
+    while ((index = scores->slots[i]) != -1)
+    {
+        const UserScore *user = &scores->users[index];
+        if (user->hash == hash && user->length == length && memcmp(user->username, username, length) == 0)
+        {
+            return index;
+        }
+        i = (i + 1) & scores->slot_mask;
+    }
+    *slot = i;
+    return -1;
+}
+
+// Add score and count to a user, creating it if needed. username must stay
+// valid as long as the table. Returns 0 on success, -1 if memory ran out
+// (the table is freed then).
+static inline int hunt_scores_add(HuntScores *scores, const char *username, int score, int count)
+{
+    uint32_t length;
+    uint32_t hash = hunt_scores_hash(username, &length);
+    uint32_t slot;
+    int index = hunt_scores_find(scores, username, length, hash, &slot);
+    if (index != -1)
+    {
+        scores->users[index].total_score += score;
+        scores->users[index].treasure_count += count;
+        return 0;
+    }
+
+    // The user table grows geometrically, so every user is kept
+    if (scores->user_count == scores->user_capacity)
+    {
+        int capacity = scores->user_capacity ? scores->user_capacity * 2 : 16;
+        UserScore *grown = realloc(scores->users, (size_t)capacity * sizeof(UserScore));
+        if (!grown)
+        {
+            hunt_scores_free(scores);
+            return -1;
+        }
+        scores->users = grown;
+        scores->user_capacity = capacity;
+    }
+    index = scores->user_count++;
+    UserScore *user = &scores->users[index];
+    user->username = username;
+    user->total_score = score;
+    user->treasure_count = count;
+    user->hash = hash;
+    user->length = length;
+    scores->slots[slot] = index;
+
+    // Keep the table at most half full so probe runs stay short
+    if ((uint32_t)scores->user_count * 2 > scores->slot_mask + 1 && hunt_scores_grow_slots(scores) != 0)
+    {
+        hunt_scores_free(scores);
+        return -1;
+    }
+    return 0;
+}
+
+// Add up the value of every live treasure per user in one pass: each
+// username is hashed once and looked up in an open addressing table.
+// Returns 0 on success, -1 if memory ran out.
+static inline int hunt_scores_compute(const TreasureView *view, HuntScores *scores)
+{
+    if (hunt_scores_init(scores) != 0)
+    {
+        return -1;
+    }
+
+    TreasureCursor cursor;
+    Treasure treasure;
+    Treasure *t = &treasure;
+    treasure_cursor_init(view, &cursor);
+    while (treasure_view_next(view, &cursor, t))
+    {
+        if (hunt_scores_add(scores, t->username, t->value, 1) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Remove users left without treasures (all of theirs were removed)
+static inline int hunt_scores_drop_empty(HuntScores *scores)
+{
+    int kept = 0;
+    for (int i = 0; i < scores->user_count; i++)
+    {
+        if (scores->users[i].treasure_count > 0)
+        {
+            scores->users[kept++] = scores->users[i];
+        }
+    }
+    if (kept == scores->user_count)
+    {
+        return 0;
+    }
+    scores->user_count = kept;
+    free(scores->slots);
+    scores->slots = NULL;
+    scores->slot_mask = 0;
+    return hunt_scores_grow_slots(scores);
+}
+
+// Size of the scores.dat record for username
+static inline size_t score_record_size(const char *username)
+{
+    return sizeof(ScoreRecord) + strlen(username) + 1;
+}
+
+// Encode a scores.dat record into buf, returning its size
+static inline size_t score_record_encode(unsigned char *buf, const char *username, int score, int count)
+{
+    ScoreRecord record;
+    record.score = score;
+    record.treasure_count = count;
+    record.name_len = (uint32_t)strlen(username);
+    record.reserved = 0;
+    memcpy(buf, &record, sizeof(record));
+    memcpy(buf + sizeof(record), username, record.name_len + 1);
+    return sizeof(record) + record.name_len + 1;
+}
+
+static inline void score_source_of_view(const TreasureView *view, ScoreSource *source)
+{
+    source->inode = view->inode;
+    source->end = (uint64_t)view->size;
+    source->live_count = (uint32_t)view->live_count;
+}
+
+// Whether a scores.dat header describes source
+static inline int score_file_describes(const ScoreFileHeader *header, const ScoreSource *source)
+{
+    return header->source_inode == source->inode && header->source_end == source->end &&
+           header->source_live_count == source->live_count;
+}
+
+// Whether a scores.dat header describes the treasure file contents of view
+static inline int score_file_matches(const ScoreFileHeader *header, const TreasureView *view)
+{
+    ScoreSource source;
+    score_source_of_view(view, &source);
+    return score_file_describes(header, &source);
+}
+
+static inline void score_file_free(ScoreFile *file)
+{
+    hunt_scores_free(&file->scores);
+    free(file->data);
+    memset(file, 0, sizeof(*file));
+}
+
+// Read scores.dat and add its delta records to the table. Users without
+// treasures are dropped. Returns 0 on success, -1 if the file is missing
+// or damaged.
+static inline int score_file_read(const char *path, ScoreFile *file)
+{
+    memset(file, 0, sizeof(*file));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ScoreFileHeader) ||
+        !(file->data = malloc((size_t)st.st_size)) ||
+        read(fd, file->data, (size_t)st.st_size) != (ssize_t)st.st_size)
+    {
+        close(fd);
+        free(file->data);
+        file->data = NULL;
+        return -1;
+    }
+    close(fd);
+    file->size = (size_t)st.st_size;
+
+    ScoreFileHeader *header = &file->header;
+    memcpy(header, file->data, sizeof(*header));
+    if (memcmp(header->magic, SCORE_MAGIC, 4) != 0 || header->version != SCORE_FORMAT_VERSION ||
+        header->base_end < sizeof(*header) || header->base_end > header->data_end ||
+        header->data_end > file->size || hunt_scores_init(&file->scores) != 0)
+    {
+        score_file_free(file);
+        return -1;
+    }
+
+    size_t offset = sizeof(*header);
+    while (offset < header->data_end)
+    {
+        ScoreRecord record;
+        if (header->data_end - offset < sizeof(record))
+        {
+            break;
+        }
+        memcpy(&record, file->data + offset, sizeof(record));
+        const char *username = (const char *)file->data + offset + sizeof(record);
+        if (header->data_end - offset - sizeof(record) < (uint64_t)record.name_len + 1 ||
+            username[record.name_len] != '\0' ||
+            hunt_scores_add(&file->scores, username, record.score, record.treasure_count) != 0)
+        {
+            break;
+        }
+        offset += sizeof(record) + record.name_len + 1;
+    }
+
+    if (offset != header->data_end || hunt_scores_drop_empty(&file->scores) != 0)
+    {
+        score_file_free(file);
+        return -1;
+    }
+    return 0;
+}
+
+// Ranking order: higher score first, ties by username
+static inline int hunt_scores_before(const UserScore *a, const UserScore *b)
+{
+    if (a->total_score != b->total_score)
+    {
+        return a->total_score > b->total_score;
+    }
+    return strcmp(a->username, b->username) < 0;
+}
+
+static inline int hunt_scores_compare(const void *a, const void *b)
+{
+    const UserScore *x = a, *y = b;
+    return hunt_scores_before(x, y) ? -1 : hunt_scores_before(y, x) ? 1 : 0;
+}
+
+// Username order, used for the table stored in scores.dat
+static inline int hunt_scores_compare_names(const void *a, const void *b)
+{
+    const UserScore *x = a, *y = b;
+    return strcmp(x->username, y->username);
+}
+
+// Move the min-heap entry at i down (heap root = worst of the kept users)
+static inline void hunt_scores_sift_down(UserScore *heap, int count, int i)
+{
+    while (1)
+    {
+        int worst = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && hunt_scores_before(&heap[worst], &heap[left]))
+        {
+            worst = left;
+        }
+        if (right < count && hunt_scores_before(&heap[worst], &heap[right]))
+        {
+            worst = right;
+        }
+        if (worst == i)
+        {
+            return;
+        }
+        UserScore tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+// Reorder the users so the best k come first, ranked. k <= 0 ranks all
+// users. A heap of k users is kept while scanning, so this costs
+// O(users log k). Returns the number of ranked users. The slot table is
+// dropped, as it no longer matches the order.
+static inline int hunt_scores_top(HuntScores *scores, int k)
+{
+    free(scores->slots);
+    scores->slots = NULL;
+
+    int count = scores->user_count;
+    if (k <= 0 || k > count)
+    {
+        k = count;
+    }
+    if (k < count)
+    {
+        UserScore *users = scores->users;
+        for (int i = k / 2 - 1; i >= 0; i--)
+        {
+            hunt_scores_sift_down(users, k, i);
+        }
+        for (int i = k; i < count; i++)
+        {
+            if (hunt_scores_before(&users[i], &users[0]))
+            {
+                UserScore tmp = users[0];
+                users[0] = users[i];
+                users[i] = tmp;
+                hunt_scores_sift_down(users, k, 0);
+            }
+        }
+    }
+    qsort(scores->users, (size_t)k, sizeof(UserScore), hunt_scores_compare);
+    return k;
+}
+
+// Score table as shown to the user, titled "Scores for <title>"
+static inline void score_table_begin(FILE *out, const char *title)
+{
+    fprintf(out, "\nScores for %s\n", title);
+    fprintf(out, "----------------------------------------\n");
+    fprintf(out, "Username            | Score | Treasures\n");
+    fprintf(out, "----------------------------------------\n");
+}
+
+static inline void score_table_header(FILE *out, const char *hunt_id)
+{
+    char title[MAX_STRING + 8];
+    snprintf(title, sizeof(title), "Hunt %s", hunt_id);
+    score_table_begin(out, title);
+}
+
+static inline void score_table_row(FILE *out, const char *username, int score, int treasures)
+{
+    fprintf(out, "%-18s | %5d | %9d\n", username, score, treasures);
+}
+
+static inline void score_table_footer(FILE *out)
+{
+    fprintf(out, "----------------------------------------\n");
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef HUNT_SEARCH_H
+#define HUNT_SEARCH_H
+
+// Clue word index of a hunt, used by treasure_manager's "search" command
+// (also served by the monitor).
+//
+// hunt/hunt<ID>/clues.idx has the layout of spatial.idx (see
+// hunt_spatial.h) with the magic "TRCL": sorted runs of uint64 key |
+// uint64 record offset entries, kept up to date the same way on add and
+// rebuilt on compact. Here the key is the hash of a clue word, and every
+// record has one entry per distinct word of its clue. Within a run the
+// entries of a word are consecutive and ordered by record offset, and each
+// run only holds records appended after those of the runs before it, so
+// the runs of a word, taken in order, form one posting list sorted by
+// offset. Removed records keep their entries until the next compaction;
+// their tombstone flag is checked when the postings are read.
+//
+// A word is a run of ASCII letters and digits (lowercased) or non-ASCII
+// bytes, so UTF-8 words are kept whole. Matches are confirmed against the
+// clue text, so a hash collision never produces a wrong result.
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "treasure_store.h"
+#include "hunt_spatial.h"
+
+#define CLUE_INDEX_MAGIC "TRCL"
+#define CLUE_MAX_WORDS (MAX_CLUE / 2 + 1) // Words in the longest clue
+#define SEARCH_MAX_TERMS 16
+
+static inline int clue_word_byte(unsigned char c)
+{
+    return c >= 0x80 || isalnum(c);
+}
+
+// Find the next word at or after *p. Sets *word and *length and moves *p
+// past it. Returns 0 at the end of the text.
+static inline int clue_next_word(const char **p, const char **word, size_t *length)
+{
+    const unsigned char *s = (const unsigned char *)*p;
+    while (*s && !clue_word_byte(*s))
+    {
+        s++;
+    }
+    if (!*s)
+    {
+        *p = (const char *)s;
+        return 0;
+    }
+    const unsigned char *start = s;
+    while (*s && clue_word_byte(*s))
+    {
+        s++;
+    }
+    *word = (const char *)start;
+    *length = (size_t)(s - start);
+    *p = (const char *)s;
+    return 1;
+}
+
+// 64-bit FNV-1a hash of a word, ignoring ASCII case
+static inline uint64_t clue_word_hash(const char *word, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)tolower((unsigned char)word[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static inline int clue_compare_hashes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Hashes of the distinct words of a clue, sorted. hashes needs room for
+// CLUE_MAX_WORDS entries. Returns the number of hashes.
+static inline int clue_word_hashes(const char *clue, uint64_t *hashes)
+{
+    const char *p = clue, *word;
+    size_t length;
+    int count = 0;
+    while (count < CLUE_MAX_WORDS && clue_next_word(&p, &word, &length))
+    {
+        hashes[count++] = clue_word_hash(word, length);
+    }
+    qsort(hashes, (size_t)count, sizeof(uint64_t), clue_compare_hashes);
+
+    int distinct = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (distinct == 0 || hashes[distinct - 1] != hashes[i])
+        {
+            hashes[distinct++] = hashes[i];
+        }
+    }
+    return distinct;
+}
+
+// Whether a clue contains a word, ignoring ASCII case
+static inline int clue_contains_word(const char *clue, const char *term, size_t term_length)
+{
+    const char *p = clue, *word;
+    size_t length;
+    while (clue_next_word(&p, &word, &length))
+    {
+        if (length == term_length && strncasecmp(word, term, length) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Posting list of one search term: its entries in each run of clues.idx,
+// oldest run first, so the offsets ascend across the whole list
+typedef struct
+{
+    const char *word;
+    size_t length;
+    uint64_t hash;
+    const SpatialEntry *entries[SPATIAL_MAX_RUNS];
+    uint64_t counts[SPATIAL_MAX_RUNS];
+    uint32_t run_count;
+    uint64_t total;
+    uint32_t run;  // Position of the intersection cursor
+    uint64_t next;
+} PostingList;
+
+// Function to find the postings of list->hash in every run of index
+static inline void posting_list_open(PostingList *list, const SpatialIndex *index)
+{
+    list->run_count = index->header.run_count;
+    list->total = 0;
+    list->run = 0;
+    list->next = 0;
+    for (uint32_t r = 0; r < index->header.run_count; r++)
+    {
+        const SpatialEntry *entries = spatial_run_entries(index, r);
+        uint64_t count = index->header.runs[r].count;
+        uint64_t first = spatial_lower_bound(entries, count, list->hash);
+        uint64_t last = first;
+        while (last < count && entries[last].key == list->hash)
+        {
+            last++;
+        }
+        list->entries[r] = entries + first;
+        list->counts[r] = last - first;
+        list->total += last - first;
+    }
+}
+
+// Move the cursor of a posting list to its first offset >= offset, with
+// a galloping search so long lists are skipped through in O(log) steps.
+// Returns 0 when the list is exhausted.
+static inline int posting_list_seek(PostingList *list, uint64_t offset, uint64_t *found)
+{
+    for (; list->run < list->run_count; list->run++, list->next = 0)
+    {
+        const SpatialEntry *entries = list->entries[list->run];
+        uint64_t count = list->counts[list->run];
+        if (list->next >= count || entries[count - 1].offset < offset)
+        {
+            continue;
+        }
+
+        uint64_t low = list->next, step = 1, high = low;
+        while (high < count && entries[high].offset < offset)
+        {
+            low = high + 1;
+            high += step;
+            step *= 2;
+        }
+        if (high > count)
+        {
+            high = count;
+        }
+        while (low < high)
+        {
+            uint64_t mid = low + (high - low) / 2;
+            if (entries[mid].offset < offset)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        list->next = low;
+        *found = entries[low].offset;
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef HUNT_SPATIAL_H
+#define HUNT_SPATIAL_H
+
+// Spatial index of a hunt, used by treasure_manager's "near" and "bbox"
+// queries (also served by the monitor).
+//
+// hunt/hunt<ID>/spatial.idx lists the records of treasures.dat by location
+// (native byte order):
+//   header:  "TRSP" | uint32 version | uint32 run_count | uint32 reserved |
+//            uint64 data_inode | uint64 data_size | uint64 file_end |
+//            SPATIAL_MAX_RUNS x (uint64 run offset | uint64 entry count)
+//   run:     entries of uint64 key | uint64 record offset, sorted by key
+// The key interleaves the bits of the quantized longitude and latitude
+// (a geohash), so the treasures of any geohash cell have consecutive keys
+// and a query only reads the key ranges of the few cells covering it.
+//
+// Adds append a sorted run for the new records. Runs of similar size are
+// merged, so there are O(log n) runs and each entry is rewritten O(log n)
+// times. A merged run is written past file_end before the header points at
+// it, so runs a reader is using are never overwritten; the file is
+// rewritten when dead runs make up half of it. Removes only set the
+// tombstone flag in treasures.dat, which queries check anyway. data_inode
+// and data_size identify the treasures.dat contents indexed, like in
+// treasures.idx; a stale index is rebuilt instead of trusted. clues.idx
+// (hunt_search.h) uses the same layout with other keys and magic.
+//
+// The distance functions use libm, so treasure_manager is linked with -lm:
+//   gcc -o treasure_manager treasure_manager.c -lpthread -lm
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_store.h"
+
+#define SPATIAL_MAGIC "TRSP"
+#define SPATIAL_FORMAT_VERSION 1
+#define SPATIAL_MAX_RUNS 40
+#define SPATIAL_COVER_CELLS 4 // Cells per axis a query box may span
+#define EARTH_RADIUS_M 6371008.8
+
+typedef struct
+{
+    uint64_t offset;
+    uint64_t count;
+} SpatialRun;
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t run_count;
+    uint32_t reserved;
+    uint64_t data_inode;
+    uint64_t data_size;
+    uint64_t file_end;
+    SpatialRun runs[SPATIAL_MAX_RUNS];
+} SpatialIndexHeader;
+
+typedef struct
+{
+    uint64_t key;
+    uint64_t offset;
+} SpatialEntry;
+
+// A mapped spatial.idx
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;
+    SpatialIndexHeader header;
+} SpatialIndex;
+
+// Inclusive query box in degrees; min_lon > max_lon crosses the antimeridian
+typedef struct
+{
+    double min_lat, max_lat;
+    double min_lon, max_lon;
+} SpatialBox;
+
+// Quantize a coordinate in [low, high] to 32 bits
+static inline uint32_t spatial_quantize(double value, double low, double high)
+{
+    double scaled = (value - low) / (high - low) * 4294967296.0;
+    if (!(scaled > 0))
+    {
+        return 0;
+    }
+    return scaled >= 4294967295.0 ? UINT32_MAX : (uint32_t)scaled;
+}
+
+// Spread the bits of x to the even bit positions of a 64-bit word
+static inline uint64_t spatial_spread(uint32_t x)
+{
+    uint64_t v = x;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+// Inverse of spatial_spread
+static inline uint32_t spatial_compact(uint64_t v)
+{
+    v &= 0x5555555555555555ULL;
+    v = (v | (v >> 1)) & 0x3333333333333333ULL;
+    v = (v | (v >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v >> 4)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v >> 8)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+    return (uint32_t)v;
+}
+
+// Geohash key of quantized coordinates: longitude bits first, like geohash
+static inline uint64_t spatial_key_of(uint32_t qlat, uint32_t qlon)
+{
+    return (spatial_spread(qlon) << 1) | spatial_spread(qlat);
+}
+
+static inline uint64_t spatial_key(double latitude, double longitude)
+{
+    return spatial_key_of(spatial_quantize(latitude, -90, 90), spatial_quantize(longitude, -180, 180));
+}
+
+static inline int spatial_compare_entries(const void *a, const void *b)
+{
+    const SpatialEntry *x = a, *y = b;
+    return x->key < y->key ? -1 : x->key > y->key ? 1 : (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// Great-circle distance in meters
+static inline double spatial_distance_m(double lat1, double lon1, double lat2, double lon2)
+{
+    const double to_rad = M_PI / 180.0;
+    double dlat = (lat2 - lat1) * to_rad;
+    double dlon = (lon2 - lon1) * to_rad;
+    double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1 * to_rad) * cos(lat2 * to_rad) * sin(dlon / 2) * sin(dlon / 2);
+    return 2 * EARTH_RADIUS_M * asin(sqrt(a < 1 ? a : 1));
+}
+
+// Smallest box holding every point within radius_m of (latitude, longitude)
+static inline void spatial_box_around(double latitude, double longitude, double radius_m, SpatialBox *box)
+{
+    double dlat = radius_m / EARTH_RADIUS_M * 180.0 / M_PI;
+    box->min_lat = latitude - dlat;
+    box->max_lat = latitude + dlat;
+    if (box->min_lat <= -90 || box->max_lat >= 90)
+    {
+        // The circle contains a pole, so it spans every longitude
+        box->min_lat = box->min_lat < -90 ? -90 : box->min_lat;
+        box->max_lat = box->max_lat > 90 ? 90 : box->max_lat;
+        box->min_lon = -180;
+        box->max_lon = 180;
+        return;
+    }
+
+    double sin_ratio = sin(radius_m / EARTH_RADIUS_M) / cos(latitude * M_PI / 180.0);
+    double dlon = sin_ratio >= 1 ? 180 : asin(sin_ratio) * 180.0 / M_PI;
+    if (dlon >= 180)
+    {
+        box->min_lon = -180;
+        box->max_lon = 180;
+        return;
+    }
+    box->min_lon = longitude - dlon;
+    box->max_lon = longitude + dlon;
+    if (box->min_lon < -180)
+    {
+        box->min_lon += 360;
+    }
+    if (box->max_lon > 180)
+    {
+        box->max_lon -= 360;
+    }
+}
+
+static inline int spatial_box_contains(const SpatialBox *box, double latitude, double longitude)
+{
+    if (latitude < box->min_lat || latitude > box->max_lat)
+    {
+        return 0;
+    }
+    if (box->min_lon <= box->max_lon)
+    {
+        return longitude >= box->min_lon && longitude <= box->max_lon;
+    }
+    return longitude >= box->min_lon || longitude <= box->max_lon;
+}
+
+// Key ranges covering a box that does not cross the antimeridian: the cells
+// of the finest geohash level at which the box spans at most
+// SPATIAL_COVER_CELLS cells per axis. ranges needs room for
+// SPATIAL_COVER_CELLS^2 pairs of inclusive (first, last) keys.
+// Returns the number of ranges, sorted and with neighbours joined.
+static inline int spatial_cover(uint32_t qlat0, uint32_t qlat1, uint32_t qlon0, uint32_t qlon1, uint64_t *ranges)
+{
+    int level = 32;
+    while (level > 0 && (((qlat1 >> (32 - level)) - (qlat0 >> (32 - level))) >= SPATIAL_COVER_CELLS ||
+                         ((qlon1 >> (32 - level)) - (qlon0 >> (32 - level))) >= SPATIAL_COVER_CELLS))
+    {
+        level--;
+    }
+    if (level == 0)
+    {
+        ranges[0] = 0;
+        ranges[1] = UINT64_MAX;
+        return 1;
+    }
+
+    int shift = 32 - level;
+    int count = 0;
+    for (uint64_t y = qlat0 >> shift; y <= qlat1 >> shift; y++)
+    {
+        for (uint64_t x = qlon0 >> shift; x <= qlon1 >> shift; x++)
+        {
+            uint64_t first = spatial_key_of((uint32_t)(y << shift), (uint32_t)(x << shift));
+            ranges[2 * count] = first;
+            ranges[2 * count + 1] = first | ((1ULL << (2 * shift)) - 1);
+            count++;
+        }
+    }
+
+    // Sort by first key (tiny arrays) and join adjacent ranges
+    for (int i = 1; i < count; i++)
+    {
+        for (int j = i; j > 0 && ranges[2 * j] < ranges[2 * (j - 1)]; j--)
+        {
+            uint64_t first = ranges[2 * j], last = ranges[2 * j + 1];
+            ranges[2 * j] = ranges[2 * (j - 1)];
+            ranges[2 * j + 1] = ranges[2 * (j - 1) + 1];
+            ranges[2 * (j - 1)] = first;
+            ranges[2 * (j - 1) + 1] = last;
+        }
+    }
+    int joined = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (joined > 0 && ranges[2 * (joined - 1) + 1] + 1 == ranges[2 * i])
+        {
+            ranges[2 * (joined - 1) + 1] = ranges[2 * i + 1];
+        }
+        else
+        {
+            ranges[2 * joined] = ranges[2 * i];
+            ranges[2 * joined + 1] = ranges[2 * i + 1];
+            joined++;
+        }
+    }
+    return joined;
+}
+
+// Whether a header with the given magic is valid for a file of size bytes
+static inline int spatial_header_valid(const SpatialIndexHeader *header, size_t size, const char *magic)
+{
+    if (memcmp(header->magic, magic, 4) != 0 || header->version != SPATIAL_FORMAT_VERSION ||
+        header->run_count > SPATIAL_MAX_RUNS || header->file_end > size)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->run_count; i++)
+    {
+        const SpatialRun *run = &header->runs[i];
+        if (run->offset < sizeof(*header) || run->count > (header->file_end - run->offset) / sizeof(SpatialEntry))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Map an index file with the given magic if it indexes the treasure file
+// contents of view. Returns 0 on success, -1 if it is missing, damaged or
+// stale.
+static inline int spatial_index_open(const char *path, const char *magic, const TreasureView *view,
+                                     SpatialIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SpatialIndexHeader))
+    {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    index->data = data;
+    index->size = (size_t)st.st_size;
+    memcpy(&index->header, data, sizeof(index->header));
+    if (!spatial_header_valid(&index->header, index->size, magic) || index->header.data_inode != view->inode ||
+        index->header.data_size != (uint64_t)view->size)
+    {
+        munmap(data, index->size);
+        memset(index, 0, sizeof(*index));
+        return -1;
+    }
+    return 0;
+}
+
+static inline void spatial_index_close(SpatialIndex *index)
+{
+    if (index->data)
+    {
+        munmap((void *)index->data, index->size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+// Entries of run i of an open index
+static inline const SpatialEntry *spatial_run_entries(const SpatialIndex *index, uint32_t i)
+{
+    return (const SpatialEntry *)(index->data + index->header.runs[i].offset);
+}
+
+// First entry of a run with a key >= key
+static inline uint64_t spatial_lower_bound(const SpatialEntry *entries, uint64_t count, uint64_t key)
+{
+    uint64_t low = 0, high = count;
+    while (low < high)
+    {
+        uint64_t mid = low + (high - low) / 2;
+        if (entries[mid].key < key)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+#endif
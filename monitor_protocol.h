@@ -0,0 +1,166 @@
+#ifndef MONITOR_PROTOCOL_H
+#define MONITOR_PROTOCOL_H
+
+// Framing used on the pipes between treasure_hub and the monitor
+// (treasure_manager monitor).
+//
+// Every message is a frame (native byte order):
+//   header:  uint32 length | uint32 request_id | uint16 type | uint16 status
+//   payload: length bytes
+// The hub sends FRAME_REQUEST frames whose payload is a command line such as
+// "list_treasures 1" (no newline). The monitor answers each request with any
+// number of FRAME_DATA frames carrying output text, then one FRAME_END frame
+// with the request's status and an optional message. Frames of different
+// requests carry their own request_id, so a reader never has to guess where
+// a response ends. Request ID 0 is the monitor's ready message, sent once at
+// startup as a FRAME_END.
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define FRAME_MAX_PAYLOAD (64 * 1024)
+#define FRAME_DATA_CHUNK 16384
+
+#define FRAME_REQUEST 1
+#define FRAME_DATA 2
+#define FRAME_END 3
+
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+#define STATUS_BAD_REQUEST 2
+#define STATUS_UNKNOWN_COMMAND 3
+
+typedef struct
+{
+    uint32_t length;
+    uint32_t request_id;
+    uint16_t type;
+    uint16_t status;
+} FrameHeader;
+
+// Text for a status code
+static inline const char *frame_status_name(uint16_t status)
+{
+    switch (status)
+    {
+    case STATUS_OK:
+        return "ok";
+    case STATUS_ERROR:
+        return "error";
+    case STATUS_BAD_REQUEST:
+        return "bad request";
+    case STATUS_UNKNOWN_COMMAND:
+        return "unknown command";
+    default:
+        return "unknown status";
+    }
+}
+
+// Write one frame to a blocking fd, retrying short writes.
+// Returns 0 on success, -1 on error (errno set).
+static inline int frame_write(int fd, uint32_t request_id, uint16_t type, uint16_t status,
+                              const void *payload, size_t length)
+{
+    if (length > FRAME_MAX_PAYLOAD)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    FrameHeader header;
+    header.length = (uint32_t)length;
+    header.request_id = request_id;
+    header.type = type;
+    header.status = status;
+
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = length;
+    int iovcnt = length > 0 ? 2 : 1;
+    struct iovec *next = iov;
+
+    while (iovcnt > 0)
+    {
+        ssize_t written = writev(fd, next, iovcnt);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)written >= next->iov_len)
+        {
+            written -= next->iov_len;
+            next++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            next->iov_base = (char *)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Read exactly len bytes from a blocking fd.
+// Returns 1 on success, 0 on end of file before any byte, -1 on error.
+static inline int frame_read_exact(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t got = read(fd, (char *)buf + done, len - done);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0)
+        {
+            if (done == 0)
+            {
+                return 0;
+            }
+            errno = EPIPE;
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    return 1;
+}
+
+// Read one frame from a blocking fd into payload (FRAME_MAX_PAYLOAD + 1
+// bytes; the payload is NUL terminated). Returns 1 on success, 0 on end of
+// file, -1 on error or a malformed frame.
+static inline int frame_read(int fd, FrameHeader *header, char *payload)
+{
+    int result = frame_read_exact(fd, header, sizeof(*header));
+    if (result <= 0)
+    {
+        return result;
+    }
+    if (header->length > FRAME_MAX_PAYLOAD)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (header->length > 0 && frame_read_exact(fd, payload, header->length) != 1)
+    {
+        return -1;
+    }
+    payload[header->length] = '\0';
+    return 1;
+}
+
+#endif
@@ -1,103 +1,336 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
 
-#define MAX_STRING 512
-#define MAX_CLUE 1024
-#define MAX_TREASURES 100
-#define MAX_USERS 50
+#include "treasure_store.h"
+#include "hunt_scores.h"
 
+#define MAX_SCORE_THREADS 64
+
+// Scores of one hunt. The usernames point into view or file, which stay
+// open as long as the scores are used.
 typedef struct
 {
-    int id;
-    char username[MAX_STRING];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE];
-    int value;
-} Treasure;
+    char hunt_id[MAX_STRING];
+    TreasureView view;
+    ScoreFile file;
+    HuntScores scores;
+    int loaded;
+} HuntResult;
 
+// Hunts shared by the scoring threads; each takes the next unscored one
 typedef struct
 {
-    char username[MAX_STRING];
-    int total_score;
-    int treasure_count;
-} UserScore;
+    HuntResult *hunts;
+    int hunt_count;
+    int next;
+} ScoreJobs;
 
-int main(int argc, char *argv[])
+// A scoring thread and the scores of every user over the hunts it scored
+typedef struct
 {
-    if (argc != 2)
+    pthread_t thread;
+    ScoreJobs *jobs;
+    HuntScores partial;
+    int failed;
+} ScoreWorker;
+
+// Function to load the scores of a hunt: read from scores.dat, or
+// calculated when the table is missing or behind the treasure file.
+// Returns 0 on success, -1 with an error message otherwise.
+int load_hunt_scores(HuntResult *result)
+{
+    char file_path[MAX_STRING * 2];
+    snprintf(file_path, sizeof(file_path), "hunt/hunt%s/treasures.dat", result->hunt_id);
+
+    // Usernames are referenced straight from the mapped file
+    if (treasure_view_open(file_path, &result->view) != 0)
     {
-        fprintf(stderr, "ERROR:Invalid arguments\n");
-        return 1;
+        fprintf(stderr, "ERROR:Could not open treasure file of hunt %s\n", result->hunt_id);
+        return -1;
     }
 
-    char hunt_id[MAX_STRING];
-    strncpy(hunt_id, argv[1], MAX_STRING - 1);
-    hunt_id[MAX_STRING - 1] = '\0';
+    char scores_path[MAX_STRING * 2];
+    snprintf(scores_path, sizeof(scores_path), "hunt/hunt%s/scores.dat", result->hunt_id);
+    if (score_file_read(scores_path, &result->file) == 0 && score_file_matches(&result->file.header, &result->view))
+    {
+        result->scores = result->file.scores;
+        memset(&result->file.scores, 0, sizeof(result->file.scores));
+    }
+    else
+    {
+        score_file_free(&result->file);
+        if (hunt_scores_compute(&result->view, &result->scores) != 0)
+        {
+            fprintf(stderr, "ERROR:Out of memory\n");
+            treasure_view_close(&result->view);
+            return -1;
+        }
+    }
+    result->loaded = 1;
+    return 0;
+}
 
-    char file_path[MAX_STRING * 2];
-    snprintf(file_path, sizeof(file_path), "hunt/hunt%s/treasures.dat", hunt_id);
+void free_hunt_scores(HuntResult *result)
+{
+    if (result->loaded)
+    {
+        hunt_scores_free(&result->scores);
+        score_file_free(&result->file);
+        treasure_view_close(&result->view);
+        result->loaded = 0;
+    }
+}
 
-    FILE *file = fopen(file_path, "rb");
-    if (!file)
+// Function to print ranked users in the pipe format: "username score treasures"
+void print_ranked(const HuntScores *scores, int ranked)
+{
+    for (int i = 0; i < ranked; i++)
     {
-        fprintf(stderr, "ERROR:Could not open treasure file\n");
-        return 1;
+        fprintf(stdout, "%s %d %d\n",
+                scores->users[i].username,
+                scores->users[i].total_score,
+                scores->users[i].treasure_count);
     }
+}
 
-    int treasure_count;
-    if (fread(&treasure_count, sizeof(int), 1, file) != 1)
+// Function run by each scoring thread. Hunts are taken one at a time, so a
+// large hunt does not hold up the rest, and every user is added to the
+// thread's own partial table; no locks are needed until the merge.
+void *score_worker(void *arg)
+{
+    ScoreWorker *worker = arg;
+    ScoreJobs *jobs = worker->jobs;
+    if (hunt_scores_init(&worker->partial) != 0)
     {
-        fprintf(stderr, "ERROR:Could not read treasure count\n");
-        fclose(file);
-        return 1;
+        worker->failed = 1;
+        return NULL;
     }
 
-    Treasure treasures[MAX_TREASURES];
-    if (treasure_count > 0 && fread(treasures, sizeof(Treasure), treasure_count, file) != treasure_count)
+    int i;
+    while ((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) < jobs->hunt_count)
     {
-        fprintf(stderr, "ERROR:Could not read treasures\n");
-        fclose(file);
-        return 1;
+        HuntResult *hunt = &jobs->hunts[i];
+        if (load_hunt_scores(hunt) != 0)
+        {
+            continue;
+        }
+        for (int u = 0; u < hunt->scores.user_count; u++)
+        {
+            const UserScore *user = &hunt->scores.users[u];
+            if (hunt_scores_add(&worker->partial, user->username, user->total_score, user->treasure_count) != 0)
+            {
+                worker->failed = 1;
+                return NULL;
+            }
+        }
     }
-    fclose(file);
+    return NULL;
+}
 
-    UserScore users[MAX_USERS] = {0};
-    int user_count = 0;
+static int compare_hunt_results(const void *a, const void *b)
+{
+    const HuntResult *x = a, *y = b;
+    return strcmp(x->hunt_id, y->hunt_id);
+}
 
-    // Calculate scores for each user
-    for (int i = 0; i < treasure_count; i++)
+// Function to find every hunt under hunt/, sorted by ID.
+// Returns the number of hunts, or -1 on error.
+int find_hunts(HuntResult **hunts)
+{
+    *hunts = NULL;
+    DIR *dir = opendir("hunt");
+    if (!dir)
     {
-        int found = 0;
-        for (int j = 0; j < user_count; j++)
+        return 0;
+    }
+
+    int count = 0, capacity = 16;
+    HuntResult *list = malloc((size_t)capacity * sizeof(HuntResult));
+    struct dirent *entry;
+    while (list && (entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, "hunt", 4) != 0 || entry->d_name[4] == '\0' ||
+            strlen(entry->d_name + 4) >= MAX_STRING)
         {
-            if (strcmp(users[j].username, treasures[i].username) == 0)
+            continue;
+        }
+        char file_path[MAX_STRING * 2];
+        snprintf(file_path, sizeof(file_path), "hunt/%s/treasures.dat", entry->d_name);
+        if (access(file_path, F_OK) != 0)
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            HuntResult *grown = realloc(list, (size_t)capacity * sizeof(HuntResult));
+            if (!grown)
             {
-                users[j].total_score += treasures[i].value;
-                users[j].treasure_count++;
-                found = 1;
+                free(list);
+                list = NULL;
                 break;
             }
+            list = grown;
+        }
+        memset(&list[count], 0, sizeof(HuntResult));
+        strcpy(list[count].hunt_id, entry->d_name + 4);
+        count++;
+    }
+    closedir(dir);
+
+    if (!list)
+    {
+        fprintf(stderr, "ERROR:Out of memory\n");
+        return -1;
+    }
+    qsort(list, (size_t)count, sizeof(HuntResult), compare_hunt_results);
+    *hunts = list;
+    return count;
+}
+
+// Function to score every hunt in parallel and print the ranking over all
+// of them, then each hunt's own ranking, best top_k users first. Output:
+//   all
+//   <user_count> <ranked>, then <ranked> lines "username score treasures"
+//   <hunt_count>
+//   per hunt: <hunt_id> <user_count> <ranked>, then <ranked> user lines
+// Returns the exit status.
+int score_all_hunts(int top_k)
+{
+    HuntResult *hunts;
+    int hunt_count = find_hunts(&hunts);
+    if (hunt_count < 0)
+    {
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = cores > 0 ? (int)cores : 1;
+    if (thread_count > MAX_SCORE_THREADS)
+    {
+        thread_count = MAX_SCORE_THREADS;
+    }
+    if (thread_count > hunt_count)
+    {
+        thread_count = hunt_count > 0 ? hunt_count : 1;
+    }
+
+    ScoreJobs jobs = {hunts, hunt_count, 0};
+    ScoreWorker workers[MAX_SCORE_THREADS];
+    memset(workers, 0, sizeof(workers));
+    int started = 0;
+    for (int i = 0; i < thread_count; i++)
+    {
+        workers[i].jobs = &jobs;
+        if (pthread_create(&workers[i].thread, NULL, score_worker, &workers[i]) != 0)
+        {
+            break;
         }
-        if (!found && user_count < MAX_USERS)
+        started++;
+    }
+    if (started == 0)
+    {
+        // No threads could be started: score everything here
+        score_worker(&workers[0]);
+        started = 1;
+    }
+    else
+    {
+        for (int i = 0; i < started; i++)
         {
-            strcpy(users[user_count].username, treasures[i].username);
-            users[user_count].total_score = treasures[i].value;
-            users[user_count].treasure_count = 1;
-            user_count++;
+            pthread_join(workers[i].thread, NULL);
         }
     }
 
-    // Output data in a simple format for pipe communication
-    fprintf(stdout, "%s\n%d\n", hunt_id, user_count);
-    for (int i = 0; i < user_count; i++)
+    // Merge the partial tables into the first one
+    HuntScores *global = &workers[0].partial;
+    int failed = workers[0].failed;
+    for (int i = 1; i < started && !failed; i++)
     {
-        fprintf(stdout, "%s %d %d\n",
-                users[i].username,
-                users[i].total_score,
-                users[i].treasure_count);
+        failed = workers[i].failed;
+        for (int u = 0; !failed && u < workers[i].partial.user_count; u++)
+        {
+            const UserScore *user = &workers[i].partial.users[u];
+            failed = hunt_scores_add(global, user->username, user->total_score, user->treasure_count) != 0;
+        }
+    }
+
+    if (!failed)
+    {
+        int ranked = hunt_scores_top(global, top_k);
+        fprintf(stdout, "all\n%d %d\n", global->user_count, ranked);
+        print_ranked(global, ranked);
+
+        int loaded = 0;
+        for (int i = 0; i < hunt_count; i++)
+        {
+            loaded += hunts[i].loaded;
+        }
+        fprintf(stdout, "%d\n", loaded);
+        for (int i = 0; i < hunt_count; i++)
+        {
+            if (hunts[i].loaded)
+            {
+                ranked = hunt_scores_top(&hunts[i].scores, top_k);
+                fprintf(stdout, "%s %d %d\n", hunts[i].hunt_id, hunts[i].scores.user_count, ranked);
+                print_ranked(&hunts[i].scores, ranked);
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR:Out of memory\n");
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        hunt_scores_free(&workers[i].partial);
+    }
+    for (int i = 0; i < hunt_count; i++)
+    {
+        free_hunt_scores(&hunts[i]);
     }
+    free(hunts);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    // Usage: score_calculator <hunt_id> [top_k]
+    //        score_calculator --all [top_k]
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "ERROR:Invalid arguments\n");
+        return 1;
+    }
+    int top_k = argc == 3 ? atoi(argv[2]) : 0;
+
+    if (strcmp(argv[1], "--all") == 0)
+    {
+        return score_all_hunts(top_k);
+    }
+
+    HuntResult result;
+    memset(&result, 0, sizeof(result));
+    strncpy(result.hunt_id, argv[1], MAX_STRING - 1);
+    if (load_hunt_scores(&result) != 0)
+    {
+        return 1;
+    }
+
+    // Output data in a simple format for pipe communication: the number of
+    // users and of the ranked lines that follow, then the best top_k of them
+    // (all without a limit) by score, as in score_all_hunts
+    int ranked = hunt_scores_top(&result.scores, top_k);
+    fprintf(stdout, "%s\n%d %d\n", result.hunt_id, result.scores.user_count, ranked);
+    print_ranked(&result.scores, ranked);
 
+    free_hunt_scores(&result);
     return 0;
 }
@@ -8,157 +8,389 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
+
+#include "monitor_protocol.h"
+#include "hunt_scores.h"
 
 #define MAX_COMMAND 256
 #define MAX_HUNT_ID 512
 #define MAX_STRING 512
 #define PIPE_BUF_SIZE 4096
+#define RESPONSE_TIMEOUT_MS 5000
+#define STOP_TIMEOUT_MS 3000
+#define MAX_PENDING_REQUESTS 32
 
 // Global variables
 pid_t monitor_pid = 0;
 int monitor_running = 0;
 int pipe_to_monitor[2];   // Parent writes to monitor
 int pipe_from_monitor[2]; // Parent reads from monitor
-volatile sig_atomic_t response_received = 0;
-volatile sig_atomic_t command_in_progress = 0;
+int signal_fd = -1;          // SIGCHLD is delivered here instead of to a handler
+int monitor_output_open = 0; // Whether pipe_from_monitor[0] can still produce data
+
+// Frames from the monitor are collected here until they are complete
+unsigned char frame_buffer[sizeof(FrameHeader) + FRAME_MAX_PAYLOAD];
+size_t frame_buffer_used = 0;
+uint32_t next_request_id = 1;
+
+// A request sent to the monitor whose FRAME_END has not arrived yet. Its
+// output is collected and printed in one piece when the response is
+// complete, so responses finishing in any order never interleave.
+typedef struct
+{
+    uint32_t request_id;
+    char command[MAX_COMMAND + MAX_HUNT_ID + 20];
+    char *output;
+    size_t output_len;
+    size_t output_capacity;
+    struct timespec deadline; // Reset whenever a frame of the request arrives
+} PendingRequest;
+
+PendingRequest pending_requests[MAX_PENDING_REQUESTS];
+int pending_count = 0;
+unsigned long responses_printed = 0;
+
+// Function to block SIGCHLD and receive it through signal_fd, so it can be
+// waited for together with the monitor pipe
+int setup_signal_fd()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    {
+        perror("sigprocmask failed");
+        return -1;
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0)
+    {
+        perror("signalfd failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to restore the default signal mask and SIGPIPE in a forked child before exec
+void reset_child_signals()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGPIPE, SIG_DFL);
+}
 
-// Signal handler for SIGCHLD
-void handle_sigchld(int signum)
+// Function to compute the deadline timeout_ms from now
+void set_deadline(struct timespec *deadline, int timeout_ms)
 {
-    int status;
-    pid_t pid = waitpid(monitor_pid, &status, WNOHANG);
-    if (pid > 0)
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
     {
-        monitor_running = 0;
-        printf("\nMonitor process terminated with status: %d\n", WEXITSTATUS(status));
-        close(pipe_to_monitor[1]);
-        close(pipe_from_monitor[0]);
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
     }
 }
 
-// Signal handler for SIGUSR1 (response ready from monitor)
-void handle_sigusr1(int signum)
+// Function to get the milliseconds left until deadline, never negative
+int remaining_ms(const struct timespec *deadline)
 {
-    response_received = 1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return ms > 0 ? (int)ms : 0;
 }
 
-// Function to read response from monitor
-void read_monitor_response()
+// Function to find an outstanding request by ID
+PendingRequest *find_request(uint32_t request_id)
+{
+    for (int i = 0; i < pending_count; i++)
+    {
+        if (pending_requests[i].request_id == request_id)
+        {
+            return &pending_requests[i];
+        }
+    }
+    return NULL;
+}
+
+// Function to start tracking a request sent to the monitor
+void track_request(uint32_t request_id, const char *command)
+{
+    PendingRequest *request = &pending_requests[pending_count++];
+    memset(request, 0, sizeof(*request));
+    request->request_id = request_id;
+    snprintf(request->command, sizeof(request->command), "%s", command);
+    set_deadline(&request->deadline, RESPONSE_TIMEOUT_MS);
+}
+
+// Function to stop tracking a request and free its output
+void finish_request(PendingRequest *request)
 {
-    char buffer[PIPE_BUF_SIZE];
-    ssize_t bytes_read;
-    int retries = 10; // Increased number of retries
-    int total_bytes = 0;
-    int got_initial_response = 0;
+    free(request->output);
+    *request = pending_requests[--pending_count];
+}
 
-    while (retries > 0)
+// Function to add output to a request
+void append_request_output(PendingRequest *request, const unsigned char *data, size_t length)
+{
+    if (request->output_len + length > request->output_capacity)
     {
-        bytes_read = read(pipe_from_monitor[0], buffer + total_bytes, PIPE_BUF_SIZE - total_bytes - 1);
-        if (bytes_read > 0)
+        size_t capacity = request->output_capacity ? request->output_capacity : PIPE_BUF_SIZE;
+        while (capacity < request->output_len + length)
+        {
+            capacity *= 2;
+        }
+        char *output = realloc(request->output, capacity);
+        if (!output)
         {
-            total_bytes += bytes_read;
-            buffer[total_bytes] = '\0';
+            perror("Failed to buffer monitor output");
+            return;
+        }
+        request->output = output;
+        request->output_capacity = capacity;
+    }
+    memcpy(request->output + request->output_len, data, length);
+    request->output_len += length;
+}
 
-            // Print the response if we haven't printed anything yet
-            if (!got_initial_response)
-            {
-                printf("%s", buffer);
-                fflush(stdout);
-                got_initial_response = 1;
-                total_bytes = 0; // Reset for next chunk
-            }
+// Function to report and drop requests the monitor has not answered in time
+void expire_requests()
+{
+    for (int i = 0; i < pending_count;)
+    {
+        if (remaining_ms(&pending_requests[i].deadline) == 0)
+        {
+            printf("No response received from monitor for '%s' (timeout)\n", pending_requests[i].command);
+            finish_request(&pending_requests[i]);
+            responses_printed++;
         }
-        else if (bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN))
+        else
         {
-            break;
+            i++;
         }
-        retries--;
-        usleep(100000); // 100ms delay between retries
     }
+}
 
-    // If we have any remaining data, print it
-    if (total_bytes > 0)
+// Function to get how long to wait before the next request times out (-1 for no limit)
+int next_timeout_ms()
+{
+    int timeout = -1;
+    for (int i = 0; i < pending_count; i++)
     {
-        buffer[total_bytes] = '\0';
-        printf("%s", buffer);
-        fflush(stdout);
+        int left = remaining_ms(&pending_requests[i].deadline);
+        if (timeout == -1 || left < timeout)
+        {
+            timeout = left;
+        }
     }
+    return timeout;
 }
 
-// Function to send a command to the monitor
-void send_command(const char *command)
+// Function to handle the signals queued on signal_fd
+void handle_signals()
 {
-    if (!monitor_running)
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info))
     {
-        printf("Monitor is not running\n");
-        return;
+        if (info.ssi_signo == SIGCHLD && monitor_running)
+        {
+            // Other children are reaped by whoever started them
+            int status;
+            pid_t pid = waitpid(monitor_pid, &status, WNOHANG);
+            if (pid > 0)
+            {
+                monitor_running = 0;
+                printf("\nMonitor process terminated with status: %d\n", WEXITSTATUS(status));
+                close(pipe_to_monitor[1]);
+                if (monitor_output_open)
+                {
+                    close(pipe_from_monitor[0]);
+                    monitor_output_open = 0;
+                }
+                frame_buffer_used = 0;
+                if (pending_count > 0)
+                {
+                    printf("%d request(s) left without a response\n", pending_count);
+                }
+                while (pending_count > 0)
+                {
+                    finish_request(&pending_requests[0]);
+                }
+            }
+        }
     }
+}
 
-    if (command_in_progress)
+// Function to handle one frame from the monitor. Frames of requests that
+// are no longer tracked (e.g. after a timeout) are dropped.
+void handle_frame(const FrameHeader *header, const unsigned char *payload)
+{
+    PendingRequest *request = find_request(header->request_id);
+    if (!request)
     {
-        printf("Previous command still in progress\n");
         return;
     }
 
-    printf("Debug: Sending command: %s\n", command);
-    command_in_progress = 1;
-    response_received = 0;
-
-    // Write command to pipe
-    ssize_t bytes_written = write(pipe_to_monitor[1], command, strlen(command));
-    if (bytes_written < 0)
+    append_request_output(request, payload, header->length);
+    set_deadline(&request->deadline, RESPONSE_TIMEOUT_MS);
+    if (header->type == FRAME_END)
     {
-        perror("Failed to write command to pipe");
-        command_in_progress = 0;
-        return;
+        fwrite(request->output, 1, request->output_len, stdout);
+        if (header->status != STATUS_OK)
+        {
+            printf("Monitor reported %s for '%s'\n", frame_status_name(header->status), request->command);
+        }
+        finish_request(request);
+        responses_printed++;
     }
-    bytes_written = write(pipe_to_monitor[1], "\n", 1);
-    if (bytes_written < 0)
+}
+
+// Function to read everything the monitor has written so far and handle
+// the complete frames in it
+void read_monitor_response()
+{
+    while (monitor_output_open)
     {
-        perror("Failed to write newline to pipe");
-        command_in_progress = 0;
-        return;
+        ssize_t bytes_read = read(pipe_from_monitor[0], frame_buffer + frame_buffer_used,
+                                  sizeof(frame_buffer) - frame_buffer_used);
+        if (bytes_read == 0)
+        {
+            // The monitor closed its end, stop polling it
+            close(pipe_from_monitor[0]);
+            monitor_output_open = 0;
+            break;
+        }
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        frame_buffer_used += (size_t)bytes_read;
+
+        size_t offset = 0;
+        while (frame_buffer_used - offset >= sizeof(FrameHeader))
+        {
+            FrameHeader header;
+            memcpy(&header, frame_buffer + offset, sizeof(header));
+            if (header.length > FRAME_MAX_PAYLOAD)
+            {
+                printf("Malformed frame from monitor, stopping it\n");
+                kill(monitor_pid, SIGTERM);
+                offset = frame_buffer_used;
+                break;
+            }
+            if (frame_buffer_used - offset < sizeof(header) + header.length)
+            {
+                break;
+            }
+            handle_frame(&header, frame_buffer + offset + sizeof(header));
+            offset += sizeof(header) + header.length;
+        }
+
+        // Keep the start of an incomplete frame for the next read
+        memmove(frame_buffer, frame_buffer + offset, frame_buffer_used - offset);
+        frame_buffer_used -= offset;
     }
+    fflush(stdout);
+}
 
-    // printf("Debug: Command written to pipe, sending SIGUSR1 to monitor (PID: %d)\n", monitor_pid);
+// Function to wait up to timeout_ms (-1 for no limit) for monitor output,
+// signals or, if watch_stdin is set, user input. Output and signals are
+// handled here; returns 1 if stdin is readable and 0 otherwise.
+int wait_for_events(int timeout_ms, int watch_stdin)
+{
+    struct pollfd fds[3];
+    int nfds = 0;
 
-    // Send signal to monitor to process command
-    if (kill(monitor_pid, SIGUSR1) < 0)
+    fds[nfds].fd = signal_fd;
+    fds[nfds++].events = POLLIN;
+    if (monitor_output_open)
     {
-        perror("Failed to send signal to monitor");
-        command_in_progress = 0;
-        return;
+        fds[nfds].fd = pipe_from_monitor[0];
+        fds[nfds++].events = POLLIN;
+    }
+    int stdin_slot = -1;
+    if (watch_stdin)
+    {
+        stdin_slot = nfds;
+        fds[nfds].fd = STDIN_FILENO;
+        fds[nfds++].events = POLLIN;
     }
 
-    // printf("Debug: SIGUSR1 sent, waiting for response...\n");
-
-    // Wait for response with timeout
-    int timeout = 50; // 5 seconds timeout (50 * 100ms)
-    while (!response_received && timeout > 0 && monitor_running)
+    if (poll(fds, nfds, timeout_ms) < 0)
     {
-        usleep(100000); // 100ms delay
-        timeout--;
-        if (timeout % 10 == 0)
-        { // Print every second
-            printf("Debug: Waiting for response... %d seconds left\n", timeout / 10);
+        if (errno != EINTR)
+        {
+            perror("poll failed");
         }
+        return 0;
     }
 
-    if (response_received)
+    // Output is handled before signals, so nothing the monitor wrote
+    // before exiting is lost
+    if (nfds > 1 && fds[1].fd == pipe_from_monitor[0] && fds[1].revents)
     {
-        // printf("Debug: Response received, reading...\n");
         read_monitor_response();
     }
-    else if (monitor_running)
+    if (fds[0].revents & POLLIN)
     {
-        printf("No response received from monitor (timeout)\n");
+        handle_signals();
     }
-    else
+    return stdin_slot >= 0 && fds[stdin_slot].revents != 0;
+}
+
+// Function to wait until request_id is answered or times out, handling
+// everything else that arrives meanwhile. Returns -1 if the monitor exited.
+int wait_for_request(uint32_t request_id)
+{
+    while (monitor_running && find_request(request_id))
+    {
+        wait_for_events(next_timeout_ms(), 0);
+        expire_requests();
+    }
+    return monitor_running ? 0 : -1;
+}
+
+// Function to send a command to the monitor without waiting for the
+// response, which is printed whenever it arrives. Returns the request ID,
+// or 0 if nothing was sent.
+uint32_t send_command(const char *command)
+{
+    if (!monitor_running)
+    {
+        printf("Monitor is not running\n");
+        return 0;
+    }
+
+    // Wait for a free slot instead of refusing the command
+    while (monitor_running && pending_count == MAX_PENDING_REQUESTS)
+    {
+        wait_for_events(next_timeout_ms(), 0);
+        expire_requests();
+    }
+    if (!monitor_running)
     {
-        printf("Monitor process terminated while waiting for response\n");
+        printf("Monitor is not running\n");
+        return 0;
     }
 
-    command_in_progress = 0;
+    uint32_t request_id = next_request_id++;
+    if (frame_write(pipe_to_monitor[1], request_id, FRAME_REQUEST, STATUS_OK, command, strlen(command)) != 0)
+    {
+        perror("Failed to write command to pipe");
+        return 0;
+    }
+    track_request(request_id, command);
+    return request_id;
 }
 
 // Function to start the monitor process
@@ -189,6 +421,7 @@ void start_monitor()
         // Child process - start the monitor
         close(pipe_to_monitor[1]);   // Close write end of input pipe
         close(pipe_from_monitor[0]); // Close read end of output pipe
+        reset_child_signals();
 
         // Redirect stdin to read from pipe
         dup2(pipe_to_monitor[0], STDIN_FILENO);
@@ -208,23 +441,18 @@ void start_monitor()
         close(pipe_to_monitor[0]);   // Close read end of input pipe
         close(pipe_from_monitor[1]); // Close write end of output pipe
 
-        // Set up signal handlers
-        struct sigaction sa;
-        sa.sa_handler = handle_sigusr1;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_flags = SA_RESTART;
-        sigaction(SIGUSR1, &sa, NULL);
-
-        sa.sa_handler = handle_sigchld;
-        sigaction(SIGCHLD, &sa, NULL);
-
         // Set pipes to non-blocking mode
         int flags = fcntl(pipe_from_monitor[0], F_GETFL, 0);
         fcntl(pipe_from_monitor[0], F_SETFL, flags | O_NONBLOCK);
 
         monitor_pid = pid;
         monitor_running = 1;
+        monitor_output_open = 1;
         printf("Monitor started with PID: %d\n", pid);
+
+        // The monitor announces itself with request ID 0
+        track_request(0, "start_monitor");
+        wait_for_request(0);
     }
 }
 
@@ -237,37 +465,52 @@ void stop_monitor()
         return;
     }
 
-    send_command("stop");
+    // The monitor answers everything still outstanding before it stops
+    uint32_t request_id = send_command("stop");
+    if (request_id != 0)
+    {
+        wait_for_request(request_id);
+    }
     printf("Waiting for monitor to terminate...\n");
 
-    // Wait for monitor to terminate with timeout
-    int timeout = 30; // 3 seconds timeout
-    while (monitor_running && timeout > 0)
+    // Wait for the SIGCHLD of the monitor, with timeout
+    struct timespec deadline;
+    set_deadline(&deadline, STOP_TIMEOUT_MS);
+    int timeout;
+    while (monitor_running && (timeout = remaining_ms(&deadline)) > 0)
     {
-        usleep(100000);
-        timeout--;
+        wait_for_events(timeout, 0);
     }
 
     if (monitor_running)
     {
         printf("Monitor did not terminate gracefully, forcing termination...\n");
         kill(monitor_pid, SIGTERM);
-        usleep(100000);
+        set_deadline(&deadline, 100);
+        while (monitor_running && (timeout = remaining_ms(&deadline)) > 0)
+        {
+            wait_for_events(timeout, 0);
+        }
         if (monitor_running)
         {
             kill(monitor_pid, SIGKILL);
+            while (monitor_running)
+            {
+                wait_for_events(-1, 0);
+            }
         }
     }
 }
 
-// Function to calculate scores for a hunt
-void calculate_hunt_scores(const char *hunt_id)
+// Function to start score_calculator with the given hunt argument ("--all"
+// for every hunt). Returns its output to read, or NULL.
+FILE *start_score_calculator(const char *hunt_arg, pid_t *child)
 {
     int pipefd[2];
     if (pipe(pipefd) == -1)
     {
         perror("pipe failed");
-        return;
+        return NULL;
     }
 
     pid_t pid = fork();
@@ -276,72 +519,152 @@ void calculate_hunt_scores(const char *hunt_id)
         perror("fork failed");
         close(pipefd[0]);
         close(pipefd[1]);
-        return;
+        return NULL;
     }
 
     if (pid == 0)
     {
         // Child process
         close(pipefd[0]); // Close read end
+        reset_child_signals();
 
         // Redirect stdout to pipe
         dup2(pipefd[1], STDOUT_FILENO);
         close(pipefd[1]);
 
         // Execute the score calculator
-        execl("./score_calculator", "score_calculator", hunt_id, NULL);
+        execl("./score_calculator", "score_calculator", hunt_arg, NULL);
         perror("execl failed");
         exit(1);
     }
-    else
+
+    // Parent process
+    close(pipefd[1]); // Close write end
+    FILE *pipe_read = fdopen(pipefd[0], "r");
+    if (!pipe_read)
     {
-        // Parent process
-        close(pipefd[1]); // Close write end
+        perror("fdopen failed");
+        close(pipefd[0]);
+        waitpid(pid, NULL, 0);
+        return NULL;
+    }
+    *child = pid;
+    return pipe_read;
+}
 
-        // Read from pipe
-        FILE *pipe_read = fdopen(pipefd[0], "r");
-        if (!pipe_read)
+// Function to print count ranked "username score treasures" lines of the
+// score calculator's output as table rows. Returns 0 if all were read.
+int print_score_rows(FILE *pipe_read, int count)
+{
+    char line[PIPE_BUF_SIZE];
+    char username[MAX_STRING];
+    int score, treasures;
+    for (int i = 0; i < count; i++)
+    {
+        if (!fgets(line, sizeof(line), pipe_read) ||
+            sscanf(line, "%511s %d %d", username, &score, &treasures) != 3)
         {
-            perror("fdopen failed");
-            close(pipefd[0]);
-            return;
+            return -1;
         }
+        score_table_row(stdout, username, score, treasures);
+    }
+    return 0;
+}
+
+// Function to calculate scores for a hunt with a separate score_calculator
+// process, used when the monitor is not running
+void calculate_hunt_scores(const char *hunt_id)
+{
+    pid_t pid;
+    FILE *pipe_read = start_score_calculator(hunt_id, &pid);
+    if (!pipe_read)
+    {
+        return;
+    }
+
+    char line[PIPE_BUF_SIZE];
+    char hunt_id_read[MAX_HUNT_ID];
 
-        char line[PIPE_BUF_SIZE];
-        char hunt_id_read[MAX_HUNT_ID];
+    // Read hunt ID and user count
+    if (fgets(hunt_id_read, sizeof(hunt_id_read), pipe_read))
+    {
+        hunt_id_read[strcspn(hunt_id_read, "\n")] = 0;
 
-        // Read hunt ID and user count
-        if (fgets(hunt_id_read, sizeof(hunt_id_read), pipe_read))
+        if (fgets(line, sizeof(line), pipe_read))
         {
-            hunt_id_read[strcspn(hunt_id_read, "\n")] = 0;
+            // int user_count = atoi(line);
+
+            // Print header
+            score_table_header(stdout, hunt_id_read);
 
-            if (fgets(line, sizeof(line), pipe_read))
+            // Read and format each user's data
+            char username[MAX_STRING];
+            int score, treasures;
+            while (fgets(line, sizeof(line), pipe_read))
             {
-                // int user_count = atoi(line);
-
-                // Print header
-                printf("\nScores for Hunt %s\n", hunt_id_read);
-                printf("----------------------------------------\n");
-                printf("Username            | Score | Treasures\n");
-                printf("----------------------------------------\n");
-
-                // Read and format each user's data
-                char username[MAX_STRING];
-                int score, treasures;
-                while (fgets(line, sizeof(line), pipe_read))
+                if (sscanf(line, "%s %d %d", username, &score, &treasures) == 3)
                 {
-                    if (sscanf(line, "%s %d %d", username, &score, &treasures) == 3)
-                    {
-                        printf("%-18s | %5d | %9d\n", username, score, treasures);
-                    }
+                    score_table_row(stdout, username, score, treasures);
                 }
-                printf("----------------------------------------\n");
             }
+            score_table_footer(stdout);
         }
+    }
 
-        fclose(pipe_read);
-        waitpid(pid, NULL, 0);
+    fclose(pipe_read);
+    waitpid(pid, NULL, 0);
+}
+
+// Function to rank users over every hunt, then within each hunt. One
+// score_calculator process scores all hunts in parallel instead of one
+// process per hunt.
+void calculate_all_scores()
+{
+    pid_t pid;
+    FILE *pipe_read = start_score_calculator("--all", &pid);
+    if (!pipe_read)
+    {
+        return;
     }
+
+    char line[PIPE_BUF_SIZE];
+    char hunt_id_read[MAX_HUNT_ID];
+    int user_count, ranked, hunt_count;
+    int complete = 0;
+    if (fgets(line, sizeof(line), pipe_read) && strcmp(line, "all\n") == 0 &&
+        fgets(line, sizeof(line), pipe_read) && sscanf(line, "%d %d", &user_count, &ranked) == 2)
+    {
+        char title[64];
+        snprintf(title, sizeof(title), "All Hunts (%d users)", user_count);
+        score_table_begin(stdout, title);
+        int ok = print_score_rows(pipe_read, ranked) == 0;
+        score_table_footer(stdout);
+
+        if (ok && fgets(line, sizeof(line), pipe_read) && sscanf(line, "%d", &hunt_count) == 1)
+        {
+            int shown = 0;
+            while (shown < hunt_count && fgets(line, sizeof(line), pipe_read) &&
+                   sscanf(line, "%511s %d %d", hunt_id_read, &user_count, &ranked) == 3)
+            {
+                score_table_header(stdout, hunt_id_read);
+                ok = print_score_rows(pipe_read, ranked) == 0;
+                score_table_footer(stdout);
+                if (!ok)
+                {
+                    break;
+                }
+                shown++;
+            }
+            complete = shown == hunt_count;
+        }
+    }
+    if (!complete)
+    {
+        printf("Error: Incomplete output from score_calculator\n");
+    }
+
+    fclose(pipe_read);
+    waitpid(pid, NULL, 0);
 }
 
 void display_commands()
@@ -352,31 +675,26 @@ void display_commands()
     printf("  list_hunts - List all available hunts\n");
     printf("  list_treasures - List all treasures in a hunt\n");
     printf("  view_treasure - View a specific treasure\n");
-    printf("  calculate_score - Calculate scores for a hunt\n");
+    printf("  calculate_score - Calculate scores for a hunt (--all for every hunt)\n");
     printf("  exit - Exit the program\n");
     printf("\nEnter command: ");
 }
 
 int main()
 {
-    // Set up signal handlers
-    struct sigaction sa;
-    sa.sa_handler = handle_sigusr1;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if (sigaction(SIGUSR1, &sa, NULL) < 0)
-    {
-        perror("sigaction failed");
-        return 1;
-    }
-
-    sa.sa_handler = handle_sigchld;
-    if (sigaction(SIGCHLD, &sa, NULL) < 0)
+    // Signals are read from signal_fd alongside the monitor pipe and stdin
+    if (setup_signal_fd() < 0)
     {
-        perror("sigaction failed");
         return 1;
     }
 
+    // A monitor that exits mid-request is reported through SIGCHLD
+    signal(SIGPIPE, SIG_IGN);
+
+    // stdin is unbuffered so that poll on it never misses input that
+    // stdio has already read ahead
+    setvbuf(stdin, NULL, _IONBF, 0);
+
     char command[MAX_COMMAND];
     char hunt_id[MAX_HUNT_ID];
     int treasure_id;
@@ -386,6 +704,21 @@ int main()
 
     while (1)
     {
+        // Responses, timeouts and monitor termination are reported while
+        // waiting for input
+        fflush(stdout);
+        unsigned long printed = responses_printed;
+        while (!wait_for_events(next_timeout_ms(), 1))
+        {
+            expire_requests();
+            if (responses_printed != printed && pending_count == 0)
+            {
+                printf("\nEnter command: ");
+                fflush(stdout);
+                printed = responses_printed;
+            }
+        }
+
         if (fgets(command, sizeof(command), stdin) == NULL)
         {
             break;
@@ -453,7 +786,22 @@ int main()
                 while (end > start && isspace(*end))
                     *end-- = '\0';
 
-                calculate_hunt_scores(start);
+                // The monitor scores from its cached hunts; without it a
+                // score_calculator process is started
+                if (strcmp(start, "--all") == 0)
+                {
+                    calculate_all_scores();
+                }
+                else if (monitor_running)
+                {
+                    char full_command[MAX_COMMAND + MAX_HUNT_ID];
+                    snprintf(full_command, sizeof(full_command), "calculate_score %s", start);
+                    send_command(full_command);
+                }
+                else
+                {
+                    calculate_hunt_scores(start);
+                }
             }
         }
         else if (strcmp(command, "stop_monitor") == 0)
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // For fopencookie
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,798 +10,5347 @@
 #include <dirent.h>
 #include <signal.h>
 #include <ctype.h>
+#include <limits.h>
+#include <sys/uio.h> // For writev
 #include <fcntl.h> // For open, read, write
+#include <sys/file.h> // For flock
+#include <pthread.h>
+#include <sched.h> // For sched_yield
+
+#include "treasure_store.h"
+#include "monitor_protocol.h"
+#include "hunt_scores.h"
+#include "hunt_spatial.h"
+#include "hunt_distance.h"
+#include "hunt_search.h"
+#include "hunt_log.h"
 
-#define MAX_STRING 512
-#define MAX_CLUE 1024
-#define MAX_TREASURES 100
-#define MAX_LOG_DETAILS 1024 // Increased buffer size for log details
 #define COMMAND_FILE "monitor_command.txt"
 #define RESPONSE_FILE "monitor_response.txt"
 #define MAX_COMMAND 1024
 #define PIPE_BUF_SIZE 4096
-
-// Structure to hold treasure information
-typedef struct
-{
-    int id;
-    char username[MAX_STRING];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE];
-    int value;
-} Treasure;
-
-// Structure to hold hunt information
-typedef struct
-{
-    char hunt_id[MAX_STRING];
-    Treasure treasures[MAX_TREASURES];
-    int treasure_count;
-} Hunt;
+#define MERGED_LOG_FILE "hunt_log.txt"
+#define MERGE_OFFSET_FILE "merged_log_offset" // Of logged_hunt.bin
+#define LOG_BUFFER_SIZE (64 * 1024)
+#define LOG_RING_SLOTS 1024 // Power of two
+#define ACCESS_LOG_ENV "TREASURE_ACCESS_LOG"
+#define ACCESS_SAMPLE_DEFAULT 100
+#define ACCESS_COUNT_DEFAULT_MS 1000
+#define CATALOG_FILE "hunt/catalog.dat"
+#define DURABILITY_ENV "TREASURE_DURABILITY"
+#define GROUP_COMMIT_DEFAULT_MS 10
+#define MAX_PENDING_SYNCS 64
+#define MONITOR_WORKERS 4
+#define HUNT_CACHE_MAX 32
+#define SCORE_DELTA_MIN_FOLD (64 * 1024)
+#define IMPORT_BATCH_MAX 8192
+#define IMPORT_STRINGS_SIZE (4 * 1024 * 1024)
+#define IMPORT_MAX_REPORTED 10
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+#define EXPORT_IOV_MAX 1024
+#define EXPORT_COPY_MAX 64 // Shorter strings are copied instead of referenced
+#define NEAREST_DEFAULT 10
+#define BENCH_DEFAULT_QUERIES 20
 
 // Function declarations
 void add_treasure(const char *hunt_id);
-void list_treasures(const char *hunt_id);
-void view_treasure(const char *hunt_id, int treasure_id);
+void list_treasures(const char *hunt_id, FILE *out);
+void view_treasure(const char *hunt_id, int treasure_id, FILE *out);
 void create_hunt_directory(const char *hunt_id);
 char *get_treasure_file_path(const char *hunt_id);
-void save_treasures(const char *hunt_id, Hunt *hunt);
+char *get_index_file_path(const char *hunt_id);
+char *get_scores_file_path(const char *hunt_id);
+char *get_spatial_file_path(const char *hunt_id);
+char *get_clue_file_path(const char *hunt_id);
+int find_treasure(const TreasureView *view, const char *hunt_id, int treasure_id, Treasure *t, uint64_t *offset);
+int lock_hunt(const char *hunt_id);
+int append_treasures(const char *hunt_id, Treasure *batch, int count);
+int import_treasures(const char *hunt_id, const char *path);
+int export_treasures(const char *hunt_id, const char *format);
+int near_treasures(const char *hunt_id, double latitude, double longitude, double radius_m, FILE *out);
+int bbox_treasures(const char *hunt_id, double min_lat, double min_lon, double max_lat, double max_lon, FILE *out);
+int nearest_treasures(const char *hunt_id, double latitude, double longitude, int k, FILE *out);
+int bench_distance(const char *hunt_id, int queries, FILE *out);
+int search_treasures(const char *hunt_id, const char *query, FILE *out);
+void durability_init();
+void access_log_init();
+void update_catalog(const char *hunt_id, int live_count, long long value_delta);
+void remove_from_catalog(const char *hunt_id);
+int read_catalog(CatalogEntry **entries);
+int rebuild_scores(const char *hunt_id);
+int rebuild_spatial_index(const char *hunt_id);
+int rebuild_clue_index(const char *hunt_id);
+void update_spatial_index(const char *hunt_id, uint64_t data_inode, uint64_t old_end, uint64_t new_end,
+                          const Treasure *batch, const uint64_t *offsets, int count);
+void update_scores(const char *hunt_id, const ScoreSource *before, const ScoreSource *after,
+                   const Treasure *changes, int count, int sign);
+int compact_hunt(const char *hunt_id);
+int verify_scores(const char *hunt_id);
+int save_treasures(const char *hunt_id, Hunt *hunt);
 Hunt *load_treasures(const char *hunt_id);
-void log_operation(const char *hunt_id, const char *operation, const char *details);
-void create_log_symlinks();
-void merge_hunt_logs();
+void log_operation(const char *hunt_id, const LogEvent *event);
+void log_access(const char *hunt_id, const LogEvent *event);
+void flush_hunt_logs();
+void stop_log_writer();
+void close_hunt_log(const char *hunt_id);
+int dump_hunt_log(const char *hunt_id, FILE *out);
+void link_hunt_log(const char *hunt_id);
+int repair_log_links();
+void merge_hunt_logs(const char *hunt_id);
 void remove_treasure(const char *hunt_id, int treasure_id);
 void remove_hunt(const char *hunt_id);
-void handle_sigusr1(int signum);
 void monitor_mode();
 void process_command(const char *command);
 void display_commands();
 
 // Add these global variables after the includes
 static volatile sig_atomic_t running = 1;
-volatile sig_atomic_t command_ready = 0;
 
-// Function to merge hunt logs into a single file
-void merge_hunt_logs()
+// How treasure writes reach stable storage, chosen with TREASURE_DURABILITY
+typedef enum
 {
-    int output_file = open("hunt_log.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (output_file == -1)
-    {
-        perror("Error opening hunt_log.txt");
-        return;
-    }
+    DURABILITY_SYNC,  // "sync": fdatasync before a write is acknowledged (default)
+    DURABILITY_GROUP, // "group[:ms]": fdatasync at most every ms milliseconds and at exit
+    DURABILITY_NONE   // "none": leave flushing to the kernel
+} DurabilityMode;
 
-    DIR *hunt_dir = opendir("hunt");
-    if (hunt_dir == NULL)
+static DurabilityMode durability = DURABILITY_SYNC;
+static long group_commit_ms = GROUP_COMMIT_DEFAULT_MS;
+
+// Writes acknowledged in group mode but not synced yet. Monitor workers
+// and the group committer share them under durability_lock.
+static int pending_syncs[MAX_PENDING_SYNCS];
+static int pending_sync_count = 0;
+static struct timespec pending_since; // CLOCK_MONOTONIC, of the oldest pending write
+static int group_committer_running = 0;
+static pthread_mutex_t durability_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t durability_pending; // Uses CLOCK_MONOTONIC, set up by start_group_committer
+static pthread_once_t group_commit_once = PTHREAD_ONCE_INIT;
+
+// Function to sync every pending file. Called with durability_lock held.
+static void sync_pending_files()
+{
+    for (int i = 0; i < pending_sync_count; i++)
     {
-        perror("Error opening hunt directory");
-        close(output_file);
-        return;
+        if (fdatasync(pending_syncs[i]) != 0)
+        {
+            perror("Error syncing treasure file");
+        }
+        close(pending_syncs[i]);
     }
+    pending_sync_count = 0;
+}
 
-    struct dirent *entry;
-    struct stat st;
-    char log_path[MAX_STRING];
-    char buffer[1024];
-    char output_buffer[MAX_STRING];
+// Function to sync every file written since the last group commit
+void durability_flush()
+{
+    pthread_mutex_lock(&durability_lock);
+    sync_pending_files();
+    pthread_mutex_unlock(&durability_lock);
+}
 
-    while ((entry = readdir(hunt_dir)) != NULL)
+// Function run by the group committer: sleep until a write is pending,
+// then sync once group_commit_ms has passed since the oldest one, so no
+// acknowledged write stays unsynced longer than that, even when no other
+// write follows it.
+static void *group_committer(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&durability_lock);
+    while (1)
     {
-        if (snprintf(log_path, sizeof(log_path), "hunt/%s", entry->d_name) >= sizeof(log_path))
+        if (pending_sync_count == 0)
         {
-            fprintf(stderr, "Path truncated: %s\n", entry->d_name);
+            pthread_cond_wait(&durability_pending, &durability_lock);
             continue;
         }
 
-        if (stat(log_path, &st) == 0 && S_ISDIR(st.st_mode)) // Ensure it's a directory
+        struct timespec deadline = pending_since, now;
+        deadline.tv_sec += group_commit_ms / 1000;
+        deadline.tv_nsec += (group_commit_ms % 1000) * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
         {
-            if (snprintf(log_path, sizeof(log_path), "hunt/%s/logged_hunt.txt", entry->d_name) >= sizeof(log_path))
-            {
-                fprintf(stderr, "Path truncated: %s\n", entry->d_name);
-                continue;
-            }
-
-            int log_file = open(log_path, O_RDONLY);
-            if (log_file != -1)
-            {
-                // printf("Appending log from: %s\n", log_path); // Debugging line
-                snprintf(output_buffer, sizeof(output_buffer), "=== Log for Hunt: %s ===\n", entry->d_name);
-                write(output_file, output_buffer, strlen(output_buffer));
-
-                ssize_t bytes_read;
-                while ((bytes_read = read(log_file, buffer, sizeof(buffer))) > 0)
-                {
-                    write(output_file, buffer, bytes_read);
-                }
-
-                write(output_file, "\n", 1);
-                close(log_file);
-            }
+            sync_pending_files();
+        }
+        else
+        {
+            pthread_cond_timedwait(&durability_pending, &durability_lock, &deadline);
         }
     }
-
-    closedir(hunt_dir);
-    close(output_file);
-    printf("\nHunt logs merged successfully into hunt_log.txt\n");
+    return NULL;
 }
 
-// Function to create symbolic links for logged_hunt.txt files
-void create_log_symlinks()
+// Function to start the group committer on the first deferred sync
+static void start_group_committer()
 {
-    DIR *hunt_dir = opendir("hunt");
-    if (!hunt_dir)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&durability_pending, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, group_committer, NULL) != 0)
     {
-        perror("Error opening hunt directory");
+        perror("Error starting group committer");
         return;
     }
+    pthread_detach(thread);
+    group_committer_running = 1;
+}
 
-    // Create links_log_hunt directory if it doesn't exist
-    if (mkdir("links_log_hunt", 0755) != 0 && errno != EEXIST)
+// Function to read the durability mode from the environment
+void durability_init()
+{
+    const char *mode = getenv(DURABILITY_ENV);
+    if (mode == NULL || strcmp(mode, "sync") == 0)
     {
-        perror("Error creating links_log_hunt directory");
-        closedir(hunt_dir);
-        return;
+        durability = DURABILITY_SYNC;
     }
-
-    struct dirent *entry;
-    struct stat st;
-    char logged_hunt_path[MAX_STRING];
-    char symlink_path[MAX_STRING];
-
-    while ((entry = readdir(hunt_dir)) != NULL)
+    else if (strcmp(mode, "none") == 0)
     {
-        if (entry->d_type == DT_DIR &&
-            strcmp(entry->d_name, ".") != 0 &&
-            strcmp(entry->d_name, "..") != 0)
+        durability = DURABILITY_NONE;
+    }
+    else if (strncmp(mode, "group", 5) == 0)
+    {
+        durability = DURABILITY_GROUP;
+        if (mode[5] == ':' && atol(mode + 6) > 0)
         {
-
-            // Check if the subdirectory starts with "hunt"
-            if (strncmp(entry->d_name, "hunt", 4) == 0)
-            {
-                const char *hunt_id = entry->d_name + 4; // Extract ID from "hunt<ID>"
-
-                snprintf(logged_hunt_path, sizeof(logged_hunt_path),
-                         "hunt/%s/logged_hunt.txt", entry->d_name);
-
-                // Check if logged_hunt.txt exists
-                if (stat(logged_hunt_path, &st) == 0)
-                {
-                    snprintf(symlink_path, sizeof(symlink_path),
-                             "links_log_hunt/logged_hunt-%s", hunt_id);
-
-                    // Remove existing symlink if any
-                    unlink(symlink_path);
-
-                    if (symlink(logged_hunt_path, symlink_path) != 0)
-                    {
-                        perror("Failed to create symlink");
-                    }
-                    else
-                    {
-                        printf("\nCreated symlink: %s -> %s\n", symlink_path, logged_hunt_path);
-                    }
-                }
-            }
+            group_commit_ms = atol(mode + 6);
         }
     }
+    else
+    {
+        fprintf(stderr, "Unknown %s '%s', using sync\n", DURABILITY_ENV, mode);
+    }
 
-    closedir(hunt_dir);
-    // printf("Symbolic links created in links_log_hunt directory.\n");
+    atexit(durability_flush);
 }
 
-// Function to log operations
-void log_operation(const char *hunt_id, const char *operation, const char *details)
+// Function to order writes: in sync mode, everything written to fd so far
+// reaches the disk before anything written after this call
+void durable_barrier(int fd)
 {
-    char log_path[MAX_STRING];
-    if (snprintf(log_path, sizeof(log_path), "hunt/hunt%s/logged_hunt.txt", hunt_id) >= sizeof(log_path))
+    if (durability == DURABILITY_SYNC && fdatasync(fd) != 0)
     {
-        fprintf(stderr, "Log path truncated for hunt_id: %s\n", hunt_id);
-        return;
+        perror("Error syncing treasure file");
     }
+}
 
-    int log_file = open(log_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (log_file == -1)
+// Function to make a completed write durable according to the mode.
+// In group mode the sync is deferred and shared with other writes; the
+// group committer does it within group_commit_ms.
+void durable_commit(int fd)
+{
+    if (durability == DURABILITY_SYNC)
     {
-        perror("Error opening log file");
+        durable_barrier(fd);
         return;
     }
-
-    time_t now;
-    time(&now);
-    char timestamp[26];
-    if (ctime_r(&now, timestamp) == NULL)
+    if (durability == DURABILITY_NONE)
     {
-        perror("Error generating timestamp");
-        close(log_file);
         return;
     }
-    timestamp[24] = '\0'; // Remove newline
-
-    char log_entry[MAX_LOG_DETAILS];
-    snprintf(log_entry, sizeof(log_entry), "[%s] %s: %s\n", timestamp, operation, details);
-    write(log_file, log_entry, strlen(log_entry));
-
-    close(log_file);
-    merge_hunt_logs();
-    create_log_symlinks();
-}
 
-// Function to create hunt subdirectory if it doesn't exist
-void create_hunt_directory(const char *hunt_id)
-{
-    char dir_path[MAX_STRING];
-    if (snprintf(dir_path, sizeof(dir_path), "hunt/hunt%s", hunt_id) >= sizeof(dir_path))
+    pthread_once(&group_commit_once, start_group_committer);
+    if (!group_committer_running)
     {
-        fprintf(stderr, "Directory path truncated for hunt_id: %s\n", hunt_id);
-        exit(EXIT_FAILURE);
+        // Nothing would sync it later
+        if (fdatasync(fd) != 0)
+        {
+            perror("Error syncing treasure file");
+        }
+        return;
     }
 
-    if (mkdir(dir_path, 0755) != 0 && errno != EEXIST)
+    pthread_mutex_lock(&durability_lock);
+    if (pending_sync_count == MAX_PENDING_SYNCS)
     {
-        perror("Error creating hunt directory");
-        exit(EXIT_FAILURE);
+        sync_pending_files();
     }
-}
-
-// Function to get the full path to the treasure file
-char *get_treasure_file_path(const char *hunt_id)
-{
-    static char path[MAX_STRING];
-    if (snprintf(path, sizeof(path), "hunt/hunt%s/treasures.dat", hunt_id) >= sizeof(path))
+    int pending = dup(fd);
+    if (pending != -1)
     {
-        fprintf(stderr, "Treasure file path truncated for hunt_id: %s\n", hunt_id);
-        exit(EXIT_FAILURE);
+        if (pending_sync_count == 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &pending_since);
+            pthread_cond_signal(&durability_pending);
+        }
+        pending_syncs[pending_sync_count++] = pending;
     }
-    return path;
+    pthread_mutex_unlock(&durability_lock);
 }
 
-// Function to save treasures to file
-void save_treasures(const char *hunt_id, Hunt *hunt)
+// Function to atomically replace path with a fully written temp_path.
+// Unless durability is off, the new contents and the rename are synced,
+// so after a crash the path holds either the old or the new file.
+int durable_replace(int temp_fd, const char *temp_path, const char *path)
 {
-    char *file_path = get_treasure_file_path(hunt_id);
-    int file = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-
-    if (file == -1)
+    if (durability != DURABILITY_NONE && fdatasync(temp_fd) != 0)
     {
-        perror("Error opening treasure file for writing");
-        exit(EXIT_FAILURE);
+        perror("Error syncing new file");
+        unlink(temp_path);
+        return -1;
+    }
+    if (rename(temp_path, path) != 0)
+    {
+        perror("Error replacing file");
+        unlink(temp_path);
+        return -1;
     }
 
-    write(file, &hunt->treasure_count, sizeof(int));
-    write(file, hunt->treasures, sizeof(Treasure) * hunt->treasure_count);
-
-    close(file);
+    if (durability != DURABILITY_NONE)
+    {
+        char dir_path[MAX_STRING];
+        snprintf(dir_path, sizeof(dir_path), "%s", path);
+        char *slash = strrchr(dir_path, '/');
+        if (slash)
+        {
+            *slash = '\0';
+            int dir = open(dir_path, O_RDONLY | O_DIRECTORY);
+            if (dir != -1)
+            {
+                fsync(dir);
+                close(dir);
+            }
+        }
+    }
+    return 0;
 }
 
-// Function to load treasures from file
-Hunt *load_treasures(const char *hunt_id)
+// Function to render the records of a hunt's binary log from offset on,
+// writing the text to out. Stops at the end of the log or at a damaged
+// record. Returns the offset after the last record rendered.
+off_t render_hunt_log(int log_file, off_t offset, FILE *out)
 {
-    static Hunt hunt;
-    strncpy(hunt.hunt_id, hunt_id, MAX_STRING - 1);
-    hunt.treasure_count = 0;
-
-    char *file_path = get_treasure_file_path(hunt_id);
-    int file = open(file_path, O_RDONLY);
+    LogFileHeader header;
+    if (pread(log_file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, LOG_MAGIC, 4) != 0 || header.version != LOG_FORMAT_VERSION)
+    {
+        return offset;
+    }
+    if (offset < (off_t)sizeof(header))
+    {
+        offset = sizeof(header);
+    }
 
-    if (file == -1)
+    size_t input_size = 256 * 1024;
+    unsigned char *input = malloc(input_size);
+    if (!input)
     {
-        return &hunt; // Return empty hunt if file doesn't exist
+        perror("Error allocating log buffer");
+        return offset;
     }
 
-    read(file, &hunt.treasure_count, sizeof(int));
-    read(file, hunt.treasures, sizeof(Treasure) * hunt.treasure_count);
+    ssize_t avail;
+    while ((avail = pread(log_file, input, input_size, offset)) > 0)
+    {
+        size_t consumed = 0, length;
+        LogRecordHeader record;
+        const char *username, *details;
+        char line[LOG_MAX_TEXT * 2 + 256];
+        while ((length = log_decode(input + consumed, (size_t)avail - consumed, &record, &username, &details)) > 0)
+        {
+            int line_length = log_render(&record, username, details, line, sizeof(line));
+            fwrite(line, 1, (size_t)line_length, out);
+            consumed += length;
+        }
+        offset += consumed;
+        if (consumed == 0)
+        {
+            break; // Damaged, or cut short by an append in progress
+        }
+    }
 
-    close(file);
-    return &hunt;
+    free(input);
+    return offset;
 }
 
-// Function to add a new treasure
-void add_treasure(const char *hunt_id)
+// Function to append the unmerged records of a hunt's log to hunt_log.txt
+// as text. The offset already copied is persisted in
+// hunt/hunt<ID>/merged_log_offset, so every record reaches hunt_log.txt
+// exactly once, even across restarts.
+void merge_hunt_logs(const char *hunt_id)
 {
-    create_hunt_directory(hunt_id);
-    Hunt *hunt = load_treasures(hunt_id);
+    char log_path[MAX_STRING];
+    char offset_path[MAX_STRING];
+    if (snprintf(log_path, sizeof(log_path), "hunt/hunt%s/%s", hunt_id, LOG_FILE_NAME) >= sizeof(log_path) ||
+        snprintf(offset_path, sizeof(offset_path), "hunt/hunt%s/%s", hunt_id, MERGE_OFFSET_FILE) >= sizeof(offset_path))
+    {
+        fprintf(stderr, "Path truncated for hunt_id: %s\n", hunt_id);
+        return;
+    }
 
-    if (hunt->treasure_count >= MAX_TREASURES)
+    int offset_file = open(offset_path, O_RDWR | O_CREAT, 0644);
+    if (offset_file == -1)
     {
-        printf("Error: Maximum number of treasures reached\n");
-        log_operation(hunt_id, "ADD", "Failed: Maximum number of treasures reached");
+        perror("Error opening merge offset file");
         return;
     }
 
-    Treasure *new_treasure = &hunt->treasures[hunt->treasure_count];
-    new_treasure->id = hunt->treasure_count + 1;
+    // Serialize merges of the same hunt (e.g. monitor and CLI running together)
+    if (flock(offset_file, LOCK_EX) != 0)
+    {
+        perror("Error locking merge offset file");
+        close(offset_file);
+        return;
+    }
 
-    char input_buffer[MAX_STRING];
+    char offset_text[32] = {0};
+    ssize_t offset_len = pread(offset_file, offset_text, sizeof(offset_text) - 1, 0);
+    off_t merged = (offset_len > 0) ? (off_t)strtoll(offset_text, NULL, 10) : 0;
 
-    printf("Enter username: ");
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    int log_file = open(log_path, O_RDONLY);
+    if (log_file == -1)
     {
-        printf("Error reading username\n");
+        close(offset_file);
         return;
     }
-    input_buffer[strcspn(input_buffer, "\n")] = 0;
-    strncpy(new_treasure->username, input_buffer, MAX_STRING - 1);
-    new_treasure->username[MAX_STRING - 1] = '\0';
 
-    printf("Enter latitude: ");
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    struct stat st;
+    if (fstat(log_file, &st) != 0)
     {
-        printf("Error reading latitude\n");
+        perror("Error reading hunt log size");
+        close(log_file);
+        close(offset_file);
         return;
     }
-    if (sscanf(input_buffer, "%lf", &new_treasure->latitude) != 1)
+
+    // The hunt log was recreated since the last merge, start over
+    if (merged > st.st_size)
     {
-        printf("Invalid latitude format\n");
-        return;
+        merged = 0;
     }
 
-    printf("Enter longitude: ");
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    if (merged == st.st_size)
     {
-        printf("Error reading longitude\n");
+        close(log_file);
+        close(offset_file);
         return;
     }
-    if (sscanf(input_buffer, "%lf", &new_treasure->longitude) != 1)
+
+    FILE *output_file = fopen(MERGED_LOG_FILE, "a");
+    if (!output_file)
     {
-        printf("Invalid longitude format\n");
+        perror("Error opening hunt_log.txt");
+        close(log_file);
+        close(offset_file);
         return;
     }
 
-    printf("Enter clue: ");
-    if (fgets(new_treasure->clue, MAX_CLUE, stdin) == NULL)
+    fprintf(output_file, "=== Log for Hunt: hunt%s ===\n", hunt_id);
+    merged = render_hunt_log(log_file, merged, output_file);
+    fprintf(output_file, "\n");
+    if (fflush(output_file) != 0)
     {
-        printf("Error reading clue\n");
+        perror("Error appending to hunt_log.txt");
+    }
+
+    // Remember how far we got so the next merge only copies new entries
+    int text_len = snprintf(offset_text, sizeof(offset_text), "%lld\n", (long long)merged);
+    if (pwrite(offset_file, offset_text, text_len, 0) != text_len || ftruncate(offset_file, text_len) != 0)
+    {
+        perror("Error saving merge offset");
+    }
+
+    fclose(output_file);
+    close(log_file);
+    close(offset_file); // Also releases the lock
+}
+
+// Function to link a hunt's log into links_log_hunt. Called when the log
+// is created, so a hunt costs one symlink() for its lifetime; remove_hunt
+// deletes the link and "repair-links" rebuilds them all.
+void link_hunt_log(const char *hunt_id)
+{
+    char logged_hunt_path[MAX_STRING];
+    char symlink_path[MAX_STRING];
+    if (snprintf(logged_hunt_path, sizeof(logged_hunt_path), "hunt/hunt%s/%s", hunt_id, LOG_FILE_NAME) >=
+            sizeof(logged_hunt_path) ||
+        snprintf(symlink_path, sizeof(symlink_path), "links_log_hunt/logged_hunt-%s", hunt_id) >= sizeof(symlink_path))
+    {
+        fprintf(stderr, "Symlink path truncated for hunt_id: %s\n", hunt_id);
         return;
     }
-    new_treasure->clue[strcspn(new_treasure->clue, "\n")] = 0;
 
-    printf("Enter value: ");
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    if (symlink(logged_hunt_path, symlink_path) == 0 || errno == EEXIST)
     {
-        printf("Error reading value\n");
         return;
     }
-    if (sscanf(input_buffer, "%d", &new_treasure->value) != 1)
+    if (errno == ENOENT && mkdir("links_log_hunt", 0755) != 0 && errno != EEXIST)
     {
-        printf("Invalid value format\n");
+        perror("Error creating links_log_hunt directory");
         return;
     }
+    if (symlink(logged_hunt_path, symlink_path) != 0 && errno != EEXIST)
+    {
+        perror("Failed to create symlink");
+    }
+}
+
+// Function to recreate the symbolic links of every hunt log and delete the
+// links of hunts that are gone. Returns 0 on success.
+int repair_log_links()
+{
+    DIR *hunt_dir = opendir("hunt");
+    if (!hunt_dir)
+    {
+        perror("Error opening hunt directory");
+        return -1;
+    }
 
-    hunt->treasure_count++;
-    save_treasures(hunt_id, hunt);
+    // Create links_log_hunt directory if it doesn't exist
+    if (mkdir("links_log_hunt", 0755) != 0 && errno != EEXIST)
+    {
+        perror("Error creating links_log_hunt directory");
+        closedir(hunt_dir);
+        return -1;
+    }
 
-    char log_details[MAX_LOG_DETAILS];
-    int written = snprintf(log_details, sizeof(log_details),
-                           "Added treasure ID: %d, Username: %s, Value: %d",
-                           new_treasure->id, new_treasure->username, new_treasure->value);
+    struct dirent *entry;
+    struct stat st;
+    char logged_hunt_path[MAX_STRING];
+    char symlink_path[MAX_STRING];
+    int result = 0;
 
-    if (written >= sizeof(log_details))
+    while ((entry = readdir(hunt_dir)) != NULL)
     {
-        // Truncate the username if needed
-        char truncated_username[MAX_STRING];
-        strncpy(truncated_username, new_treasure->username, sizeof(truncated_username) - 1);
-        truncated_username[sizeof(truncated_username) - 1] = '\0';
+        if (entry->d_type == DT_DIR &&
+            strcmp(entry->d_name, ".") != 0 &&
+            strcmp(entry->d_name, "..") != 0)
+        {
+
+            // Check if the subdirectory starts with "hunt"
+            if (strncmp(entry->d_name, "hunt", 4) == 0)
+            {
+                const char *hunt_id = entry->d_name + 4; // Extract ID from "hunt<ID>"
+
+                snprintf(logged_hunt_path, sizeof(logged_hunt_path),
+                         "hunt/%s/%s", entry->d_name, LOG_FILE_NAME);
+
+                // Check if the log exists
+                if (stat(logged_hunt_path, &st) == 0)
+                {
+                    snprintf(symlink_path, sizeof(symlink_path),
+                             "links_log_hunt/logged_hunt-%s", hunt_id);
+
+                    // Remove existing symlink if any
+                    unlink(symlink_path);
 
-        snprintf(log_details, sizeof(log_details),
-                 "Added treasure ID: %d, Username: %s, Value: %d",
-                 new_treasure->id, truncated_username, new_treasure->value);
+                    if (symlink(logged_hunt_path, symlink_path) != 0)
+                    {
+                        perror("Failed to create symlink");
+                        result = -1;
+                    }
+                    else
+                    {
+                        printf("\nCreated symlink: %s -> %s\n", symlink_path, logged_hunt_path);
+                    }
+                }
+            }
+        }
+    }
+    closedir(hunt_dir);
+
+    // Remove the links of hunts removed by older versions, or by hand
+    DIR *links_dir = opendir("links_log_hunt");
+    if (!links_dir)
+    {
+        perror("Error opening links_log_hunt directory");
+        return -1;
+    }
+    while ((entry = readdir(links_dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, "logged_hunt-", 12) != 0)
+        {
+            continue;
+        }
+        snprintf(logged_hunt_path, sizeof(logged_hunt_path), "hunt/hunt%s/%s", entry->d_name + 12, LOG_FILE_NAME);
+        if (stat(logged_hunt_path, &st) != 0 && errno == ENOENT)
+        {
+            snprintf(symlink_path, sizeof(symlink_path), "links_log_hunt/%s", entry->d_name);
+            if (unlink(symlink_path) == 0)
+            {
+                printf("\nRemoved stale symlink: %s\n", symlink_path);
+            }
+        }
+    }
+    closedir(links_dir);
+    return result;
+}
+
+// A hunt log held open by the log writer. Records are collected in the
+// buffer and appended with one write per batch.
+typedef struct HuntLog
+{
+    char hunt_id[MAX_STRING];
+    int fd;
+    size_t used;
+    unsigned char buffer[LOG_BUFFER_SIZE];
+    struct HuntLog *next;
+} HuntLog;
+
+static HuntLog *hunt_logs = NULL;
+static pthread_mutex_t hunt_logs_lock = PTHREAD_MUTEX_INITIALIZER; // Held by the writer while it writes
+
+// A record waiting in the log ring. sequence tells whose turn the slot is:
+// equal to the ring position, it is free for the producer claiming that
+// position; one past it, it holds a record for the writer.
+typedef struct
+{
+    uint64_t sequence;
+    char hunt_id[MAX_STRING];
+    uint32_t length;
+    unsigned char record[LOG_MAX_RECORD];
+} LogSlot;
+
+// Operations are logged through a bounded multi-producer, single-consumer
+// ring: a request claims a slot with one compare-and-swap, copies its
+// record in and returns, without taking a lock or touching the disk. A
+// background writer takes the records out in order, appends each batch
+// with one write per hunt and does the merge into hunt_log.txt.
+typedef struct
+{
+    LogSlot *slots;
+    uint64_t tail;     // Next position to claim (producers)
+    uint64_t head;     // Next position to write (writer only)
+    uint64_t written;  // Positions written out, under lock
+    int running;
+    int stopping;
+    int idle;          // The writer is waiting for records
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    // Records or a stop for the writer
+    pthread_cond_t flushed; // written moved on
+} LogRing;
+
+static LogRing log_ring = {NULL, 0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                           PTHREAD_COND_INITIALIZER};
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+
+// Which reads (list, view) are logged, chosen with TREASURE_ACCESS_LOG.
+// Reads are most of the requests, so by default they write nothing.
+typedef enum
+{
+    ACCESS_LOG_OFF,    // "off": reads are not logged (default)
+    ACCESS_LOG_ALL,    // "all": every read is logged
+    ACCESS_LOG_SAMPLE, // "sample[:n]": one read in n is logged
+    ACCESS_LOG_COUNT   // "count[:ms]": reads are counted per hunt, the counts logged every ms milliseconds
+} AccessLogMode;
+
+static AccessLogMode access_log = ACCESS_LOG_OFF;
+static long access_log_every = 0; // n of sample, ms of count
+static uint64_t access_reads = 0;
+
+// Reads of a hunt counted since its last ACCESS record
+typedef struct AccessCount
+{
+    char hunt_id[MAX_STRING];
+    int lists;
+    long long views;
+    int missed; // Views of a treasure that was not found
+    struct AccessCount *next;
+} AccessCount;
+
+static AccessCount *access_counts = NULL;
+static pthread_mutex_t access_counts_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec last_access_fold;
+
+// Function to read the access logging mode from the environment
+void access_log_init()
+{
+    const char *mode = getenv(ACCESS_LOG_ENV);
+    if (mode == NULL || strcmp(mode, "off") == 0)
+    {
+        access_log = ACCESS_LOG_OFF;
+    }
+    else if (strcmp(mode, "all") == 0)
+    {
+        access_log = ACCESS_LOG_ALL;
+    }
+    else if (strncmp(mode, "sample", 6) == 0)
+    {
+        access_log = ACCESS_LOG_SAMPLE;
+        access_log_every = (mode[6] == ':' && atol(mode + 7) > 0) ? atol(mode + 7) : ACCESS_SAMPLE_DEFAULT;
+    }
+    else if (strncmp(mode, "count", 5) == 0)
+    {
+        access_log = ACCESS_LOG_COUNT;
+        access_log_every = (mode[5] == ':' && atol(mode + 6) > 0) ? atol(mode + 6) : ACCESS_COUNT_DEFAULT_MS;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown %s '%s', using off\n", ACCESS_LOG_ENV, mode);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &last_access_fold);
+}
+
+// Function to open a hunt's log for appending, creating it with its file
+// header first if needed. The new file is linked into place complete, so
+// no other writer can append before the header. Returns the descriptor.
+int open_hunt_log(const char *hunt_id)
+{
+    char log_path[MAX_STRING];
+    if (snprintf(log_path, sizeof(log_path), "hunt/hunt%s/%s", hunt_id, LOG_FILE_NAME) >= sizeof(log_path))
+    {
+        fprintf(stderr, "Log path truncated for hunt_id: %s\n", hunt_id);
+        return -1;
+    }
+
+    int fd = open(log_path, O_WRONLY | O_APPEND);
+    if (fd != -1 || errno != ENOENT)
+    {
+        if (fd == -1)
+        {
+            perror("Error opening log file");
+        }
+        return fd;
+    }
+
+    char temp_path[MAX_STRING + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", log_path);
+    int temp = mkstemp(temp_path);
+    if (temp == -1)
+    {
+        perror("Error opening log file");
+        return -1;
+    }
+    fchmod(temp, 0644);
+    LogFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_MAGIC, 4);
+    header.version = LOG_FORMAT_VERSION;
+    int written = write(temp, &header, sizeof(header)) == (ssize_t)sizeof(header);
+    close(temp);
+    if (!written || (link(temp_path, log_path) != 0 && errno != EEXIST))
+    {
+        perror("Error creating log file");
+        unlink(temp_path);
+        return -1;
+    }
+    unlink(temp_path);
+    link_hunt_log(hunt_id);
+
+    fd = open(log_path, O_WRONLY | O_APPEND);
+    if (fd == -1)
+    {
+        perror("Error opening log file");
+    }
+    return fd;
+}
+
+// Function to append the buffered records of a log. A log whose hunt was
+// removed since it was opened is reopened first. Called with
+// hunt_logs_lock held.
+void write_hunt_log(HuntLog *log)
+{
+    struct stat st;
+    if (log->used == 0)
+    {
+        return;
+    }
+    if (fstat(log->fd, &st) != 0 || st.st_nlink == 0)
+    {
+        close(log->fd);
+        log->fd = open_hunt_log(log->hunt_id);
+    }
+    if (log->fd != -1 && write(log->fd, log->buffer, log->used) != (ssize_t)log->used)
+    {
+        perror("Error writing log file");
+    }
+    log->used = 0;
+}
+
+// Function to add an encoded record to its hunt's buffer. Called by the
+// writer with hunt_logs_lock held.
+static void buffer_log_record(const char *hunt_id, const unsigned char *record, uint32_t length)
+{
+    HuntLog *log = hunt_logs;
+    while (log && strcmp(log->hunt_id, hunt_id) != 0)
+    {
+        log = log->next;
+    }
+    if (!log)
+    {
+        int fd = open_hunt_log(hunt_id);
+        if (fd == -1 || !(log = malloc(sizeof(HuntLog))))
+        {
+            if (fd != -1)
+            {
+                close(fd);
+            }
+            return;
+        }
+        snprintf(log->hunt_id, sizeof(log->hunt_id), "%s", hunt_id);
+        log->fd = fd;
+        log->used = 0;
+        log->next = hunt_logs;
+        hunt_logs = log;
+    }
+    if (LOG_BUFFER_SIZE - log->used < length)
+    {
+        write_hunt_log(log);
+    }
+    memcpy(log->buffer + log->used, record, length);
+    log->used += length;
+}
+
+// Function to log the read counts as ACCESS records once the count
+// interval has passed, or when the writer is stopping. Called by the
+// writer with hunt_logs_lock held.
+static void log_access_counts(int stopping)
+{
+    if (access_log != ACCESS_LOG_COUNT)
+    {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - last_access_fold.tv_sec) * 1000 +
+                      (now.tv_nsec - last_access_fold.tv_nsec) / 1000000;
+    if (!stopping && elapsed_ms < access_log_every)
+    {
+        return;
+    }
+    last_access_fold = now;
+
+    // Take the counts, so readers start new ones while these are written
+    pthread_mutex_lock(&access_counts_lock);
+    AccessCount *counts = access_counts;
+    __atomic_store_n(&access_counts, NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&access_counts_lock);
+
+    unsigned char record[LOG_MAX_RECORD];
+    while (counts)
+    {
+        AccessCount *next = counts->next;
+        LogEvent event = {LOG_OP_ACCESS, 0, counts->missed, counts->lists, counts->views, NULL, NULL};
+        buffer_log_record(counts->hunt_id, record, (uint32_t)log_encode(&event, record));
+        free(counts);
+        counts = next;
+    }
+}
+
+// Function to put the idle writer to sleep, with log_ring.lock held. It
+// sleeps until woken, or until read counts are due to be logged.
+static void wait_for_log_records()
+{
+    if (access_log != ACCESS_LOG_COUNT || !__atomic_load_n(&access_counts, __ATOMIC_SEQ_CST))
+    {
+        pthread_cond_wait(&log_ring.wake, &log_ring.lock);
+        return;
+    }
+
+    struct timespec now, until;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - last_access_fold.tv_sec) * 1000 +
+                      (now.tv_nsec - last_access_fold.tv_nsec) / 1000000;
+    long wait_ms = access_log_every > elapsed_ms ? access_log_every - elapsed_ms : 0;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += wait_ms / 1000;
+    until.tv_nsec += (wait_ms % 1000) * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&log_ring.wake, &log_ring.lock, &until);
+}
+
+// Function run by the log writer: take every record published in the ring,
+// append them per hunt and merge what was written into hunt_log.txt, then
+// sleep until a producer wakes it. Exits once stopping
+// is set and the ring is empty.
+static void *log_writer(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        // Seen before draining, so every record published before the stop
+        // is taken in this pass
+        int stopping = __atomic_load_n(&log_ring.stopping, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&hunt_logs_lock);
+        uint64_t taken = 0;
+        while (1)
+        {
+            LogSlot *slot = &log_ring.slots[log_ring.head & (LOG_RING_SLOTS - 1)];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != log_ring.head + 1)
+            {
+                break;
+            }
+            buffer_log_record(slot->hunt_id, slot->record, slot->length);
+            __atomic_store_n(&slot->sequence, log_ring.head + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+            log_ring.head++;
+            taken++;
+        }
+        log_access_counts(stopping);
+        for (HuntLog *log = hunt_logs; log; log = log->next)
+        {
+            if (log->used > 0)
+            {
+                write_hunt_log(log);
+                merge_hunt_logs(log->hunt_id);
+            }
+        }
+        pthread_mutex_unlock(&hunt_logs_lock);
+
+        pthread_mutex_lock(&log_ring.lock);
+        log_ring.written = log_ring.head;
+        pthread_cond_broadcast(&log_ring.flushed);
+        if (taken == 0 && stopping)
+        {
+            pthread_mutex_unlock(&log_ring.lock);
+            return NULL;
+        }
+        if (taken == 0 && !log_ring.stopping)
+        {
+            // Announce the wait, then look at the ring again: a producer
+            // that published before seeing idle set is caught here, and
+            // one that sees it signals under the lock held until we wait
+            __atomic_store_n(&log_ring.idle, 1, __ATOMIC_SEQ_CST);
+            LogSlot *slot = &log_ring.slots[log_ring.head & (LOG_RING_SLOTS - 1)];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) != log_ring.head + 1)
+            {
+                wait_for_log_records();
+            }
+            __atomic_store_n(&log_ring.idle, 0, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&log_ring.lock);
+    }
+}
+
+// Function to stop the log writer once everything logged is written.
+// Runs at exit; the monitor also calls it on "stop".
+void stop_log_writer()
+{
+    pthread_mutex_lock(&log_ring.lock);
+    int running = log_ring.running;
+    log_ring.running = 0;
+    __atomic_store_n(&log_ring.stopping, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&log_ring.wake);
+    pthread_mutex_unlock(&log_ring.lock);
+    if (running)
+    {
+        pthread_join(log_ring.thread, NULL);
+    }
+}
+
+// Function to set up the ring and start the writer on the first log
+static void start_log_writer()
+{
+    log_ring.slots = malloc(LOG_RING_SLOTS * sizeof(LogSlot));
+    if (!log_ring.slots)
+    {
+        perror("Error allocating log ring");
+        return;
+    }
+    for (uint64_t i = 0; i < LOG_RING_SLOTS; i++)
+    {
+        log_ring.slots[i].sequence = i;
+    }
+    if (pthread_create(&log_ring.thread, NULL, log_writer, NULL) != 0)
+    {
+        perror("Error starting log writer");
+        free(log_ring.slots);
+        log_ring.slots = NULL;
+        return;
+    }
+    log_ring.running = 1;
+    atexit(stop_log_writer);
+}
+
+// Function to wake the writer if it is waiting for records. Called after
+// publishing; the fence orders the publish before the look at idle.
+static void wake_log_writer()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&log_ring.idle, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&log_ring.lock);
+        pthread_cond_signal(&log_ring.wake);
+        pthread_mutex_unlock(&log_ring.lock);
+    }
+}
+
+// Function to wait until everything logged so far is written and merged
+void flush_hunt_logs()
+{
+    uint64_t target = __atomic_load_n(&log_ring.tail, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&log_ring.lock);
+    while (log_ring.running && log_ring.written < target)
+    {
+        pthread_cond_signal(&log_ring.wake);
+        pthread_cond_wait(&log_ring.flushed, &log_ring.lock);
+    }
+    pthread_mutex_unlock(&log_ring.lock);
+}
+
+// Function to write out and close a hunt's log, before the hunt is removed
+void close_hunt_log(const char *hunt_id)
+{
+    flush_hunt_logs();
+    pthread_mutex_lock(&hunt_logs_lock);
+    for (HuntLog **link = &hunt_logs; *link; link = &(*link)->next)
+    {
+        HuntLog *log = *link;
+        if (strcmp(log->hunt_id, hunt_id) == 0)
+        {
+            if (log->fd != -1)
+            {
+                close(log->fd);
+            }
+            *link = log->next;
+            free(log);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hunt_logs_lock);
+}
+
+// Function to log an operation. The record is encoded into a ring slot
+// and left to the log writer; when the ring is full, the caller waits for
+// the writer to make room, so no record is ever dropped.
+void log_operation(const char *hunt_id, const LogEvent *event)
+{
+    pthread_once(&log_ring_once, start_log_writer);
+    if (!__atomic_load_n(&log_ring.running, __ATOMIC_ACQUIRE))
+    {
+        return; // Could not be started, or already stopped at exit
+    }
+
+    LogSlot *slot;
+    uint64_t position = __atomic_load_n(&log_ring.tail, __ATOMIC_RELAXED);
+    while (1)
+    {
+        slot = &log_ring.slots[position & (LOG_RING_SLOTS - 1)];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position)
+        {
+            if (__atomic_compare_exchange_n(&log_ring.tail, &position, position + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            {
+                break; // Claimed; position was reloaded on failure
+            }
+        }
+        else if (sequence < position)
+        {
+            // Full: the writer has not taken the record a lap ahead yet
+            pthread_mutex_lock(&log_ring.lock);
+            pthread_cond_signal(&log_ring.wake);
+            pthread_mutex_unlock(&log_ring.lock);
+            sched_yield();
+            position = __atomic_load_n(&log_ring.tail, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            position = __atomic_load_n(&log_ring.tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    snprintf(slot->hunt_id, sizeof(slot->hunt_id), "%s", hunt_id);
+    slot->length = (uint32_t)log_encode(event, slot->record);
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    wake_log_writer();
+}
+
+// Function to log a read (list or view) the way TREASURE_ACCESS_LOG asks.
+// In count mode only a counter is bumped; the writer logs the counts.
+void log_access(const char *hunt_id, const LogEvent *event)
+{
+    switch (access_log)
+    {
+    case ACCESS_LOG_OFF:
+        return;
+    case ACCESS_LOG_ALL:
+        log_operation(hunt_id, event);
+        return;
+    case ACCESS_LOG_SAMPLE:
+        if (__atomic_fetch_add(&access_reads, 1, __ATOMIC_RELAXED) % (uint64_t)access_log_every == 0)
+        {
+            log_operation(hunt_id, event);
+        }
+        return;
+    case ACCESS_LOG_COUNT:
+        break;
+    }
+
+    pthread_once(&log_ring_once, start_log_writer);
+    pthread_mutex_lock(&access_counts_lock);
+    AccessCount *count = access_counts;
+    int first = count == NULL;
+    while (count && strcmp(count->hunt_id, hunt_id) != 0)
+    {
+        count = count->next;
+    }
+    if (!count && (count = calloc(1, sizeof(AccessCount))))
+    {
+        snprintf(count->hunt_id, sizeof(count->hunt_id), "%s", hunt_id);
+        count->next = access_counts;
+        __atomic_store_n(&access_counts, count, __ATOMIC_RELEASE);
+    }
+    if (count && event->op == LOG_OP_LIST)
+    {
+        count->lists++;
+    }
+    else if (count)
+    {
+        count->views++;
+        count->missed += event->failed != 0;
+    }
+    pthread_mutex_unlock(&access_counts_lock);
+    if (first)
+    {
+        wake_log_writer(); // It sleeps without a timeout while no counts are pending
+    }
+}
+
+// Function to print a hunt's log as text, or the logs of every hunt for
+// "--all". Logs kept as text before the binary format are printed first.
+// Returns a STATUS_ code.
+int dump_hunt_log(const char *hunt_id, FILE *out)
+{
+    flush_hunt_logs(); // Include what this process has logged
+
+    if (strcmp(hunt_id, "--all") == 0)
+    {
+        CatalogEntry *entries;
+        int count = read_catalog(&entries);
+        if (count < 0)
+        {
+            fprintf(out, "Error: Could not read the hunt catalog\n");
+            return STATUS_ERROR;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            fprintf(out, "=== Log for Hunt: hunt%s ===\n", entries[i].hunt_id);
+            dump_hunt_log(entries[i].hunt_id, out);
+        }
+        free(entries);
+        return STATUS_OK;
+    }
+
+    char log_path[MAX_STRING];
+    char legacy_path[MAX_STRING];
+    if (snprintf(log_path, sizeof(log_path), "hunt/hunt%s/%s", hunt_id, LOG_FILE_NAME) >= sizeof(log_path) ||
+        snprintf(legacy_path, sizeof(legacy_path), "hunt/hunt%s/%s", hunt_id, LOG_LEGACY_FILE_NAME) >= sizeof(legacy_path))
+    {
+        fprintf(out, "Invalid hunt ID: %s\n", hunt_id);
+        return STATUS_BAD_REQUEST;
+    }
+
+    int legacy = open(legacy_path, O_RDONLY);
+    int log_file = open(log_path, O_RDONLY);
+    if (legacy == -1 && log_file == -1)
+    {
+        fprintf(out, "No log found for hunt: %s\n", hunt_id);
+        return STATUS_ERROR;
+    }
+
+    char buffer[4096];
+    ssize_t bytes_read;
+    while (legacy != -1 && (bytes_read = read(legacy, buffer, sizeof(buffer))) > 0)
+    {
+        fwrite(buffer, 1, (size_t)bytes_read, out);
+    }
+    if (legacy != -1)
+    {
+        close(legacy);
+    }
+    if (log_file != -1)
+    {
+        render_hunt_log(log_file, 0, out);
+        close(log_file);
+    }
+    return STATUS_OK;
+}
+
+// Function to create hunt subdirectory if it doesn't exist
+void create_hunt_directory(const char *hunt_id)
+{
+    char dir_path[MAX_STRING];
+    if (snprintf(dir_path, sizeof(dir_path), "hunt/hunt%s", hunt_id) >= sizeof(dir_path))
+    {
+        fprintf(stderr, "Directory path truncated for hunt_id: %s\n", hunt_id);
+        exit(EXIT_FAILURE);
+    }
+
+    if (mkdir(dir_path, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Error creating hunt directory");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to get the full path to the treasure file. The buffer is per
+// thread, so monitor workers can use it concurrently.
+char *get_treasure_file_path(const char *hunt_id)
+{
+    static __thread char path[MAX_STRING];
+    if (snprintf(path, sizeof(path), "hunt/hunt%s/treasures.dat", hunt_id) >= sizeof(path))
+    {
+        fprintf(stderr, "Treasure file path truncated for hunt_id: %s\n", hunt_id);
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+// Function to get the full path to the treasure ID index
+char *get_index_file_path(const char *hunt_id)
+{
+    static __thread char path[MAX_STRING];
+    if (snprintf(path, sizeof(path), "hunt/hunt%s/treasures.idx", hunt_id) >= sizeof(path))
+    {
+        fprintf(stderr, "Index file path truncated for hunt_id: %s\n", hunt_id);
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+// Function to get the full path to the hunt's score table
+char *get_scores_file_path(const char *hunt_id)
+{
+    static __thread char path[MAX_STRING];
+    if (snprintf(path, sizeof(path), "hunt/hunt%s/scores.dat", hunt_id) >= sizeof(path))
+    {
+        fprintf(stderr, "Score file path truncated for hunt_id: %s\n", hunt_id);
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+// Function to get the full path to the hunt's spatial index
+char *get_spatial_file_path(const char *hunt_id)
+{
+    static __thread char path[MAX_STRING];
+    if (snprintf(path, sizeof(path), "hunt/hunt%s/spatial.idx", hunt_id) >= sizeof(path))
+    {
+        fprintf(stderr, "Spatial index path truncated for hunt_id: %s\n", hunt_id);
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+// Function to get the full path to the hunt's clue word index
+char *get_clue_file_path(const char *hunt_id)
+{
+    static __thread char path[MAX_STRING];
+    if (snprintf(path, sizeof(path), "hunt/hunt%s/clues.idx", hunt_id) >= sizeof(path))
+    {
+        fprintf(stderr, "Clue index path truncated for hunt_id: %s\n", hunt_id);
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+// Function to write treasures.idx for the treasure file with the given inode and data_end
+void save_treasure_index(const char *hunt_id, const uint64_t *offsets, uint32_t entry_count,
+                         uint64_t data_inode, uint64_t data_end)
+{
+    char *index_path = get_index_file_path(hunt_id);
+    char temp_path[MAX_STRING + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", index_path);
+
+    TreasureIndexHeader header;
+    memcpy(header.magic, TREASURE_INDEX_MAGIC, 4);
+    header.version = TREASURE_INDEX_VERSION;
+    header.entry_count = entry_count;
+    header.reserved = 0;
+    header.data_inode = data_inode;
+    header.data_size = data_end;
+
+    // A unique temp file, so concurrent rebuilds never write into each other's
+    int file = mkstemp(temp_path);
+    if (file == -1)
+    {
+        perror("Error opening treasure index for writing");
+        return;
+    }
+    fchmod(file, 0644);
+
+    size_t entries_size = (size_t)entry_count * sizeof(uint64_t);
+    if (write(file, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+        write(file, offsets, entries_size) != (ssize_t)entries_size)
+    {
+        perror("Error writing treasure index");
+        close(file);
+        unlink(temp_path);
+        return;
+    }
+    close(file);
+
+    // The index is rebuilt whenever it does not match, so it needs no sync
+    if (rename(temp_path, index_path) != 0)
+    {
+        perror("Error replacing treasure index");
+        unlink(temp_path);
+    }
+}
+
+// Function to rebuild treasures.idx from the treasure file itself
+void rebuild_treasure_index(const char *hunt_id)
+{
+    TreasureView view;
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &view) != 0 || view.legacy)
+    {
+        treasure_view_close(&view);
+        return;
+    }
+
+    TreasureCursor cursor;
+    Treasure t;
+    uint32_t entry_count = 0;
+    treasure_cursor_init(&view, &cursor);
+    while (treasure_view_next(&view, &cursor, &t))
+    {
+        if (t.id > 0 && (uint32_t)t.id > entry_count)
+        {
+            entry_count = (uint32_t)t.id;
+        }
+    }
+
+    uint64_t *offsets = calloc(entry_count ? entry_count : 1, sizeof(uint64_t));
+    if (offsets)
+    {
+        treasure_cursor_init(&view, &cursor);
+        while (treasure_view_next(&view, &cursor, &t))
+        {
+            if (t.id > 0)
+            {
+                offsets[t.id - 1] = cursor.record_offset;
+            }
+        }
+        save_treasure_index(hunt_id, offsets, entry_count, view.inode, view.size);
+        free(offsets);
+    }
+    treasure_view_close(&view);
+}
+
+// Function to add freshly appended records to treasures.idx. The records
+// have consecutive IDs starting at first_id; old_end is the data_end the
+// index must currently describe, otherwise it is rebuilt from scratch.
+void append_treasure_index(const char *hunt_id, int first_id, const uint64_t *offsets, int count,
+                           uint64_t data_inode, uint64_t old_end, uint64_t new_end)
+{
+    int index = open(get_index_file_path(hunt_id), O_RDWR);
+    TreasureIndexHeader header;
+    if (index == -1 ||
+        pread(index, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, TREASURE_INDEX_MAGIC, 4) != 0 ||
+        header.version != TREASURE_INDEX_VERSION ||
+        header.data_inode != data_inode || header.data_size != old_end)
+    {
+        if (index != -1)
+        {
+            close(index);
+        }
+        rebuild_treasure_index(hunt_id);
+        return;
+    }
+
+    size_t entries_size = (size_t)count * sizeof(uint64_t);
+    off_t entry_offset = (off_t)(sizeof(header) + (size_t)(first_id - 1) * sizeof(uint64_t));
+    if ((uint32_t)(first_id + count - 1) > header.entry_count)
+    {
+        header.entry_count = (uint32_t)(first_id + count - 1);
+    }
+    header.data_size = new_end;
+
+    if (pwrite(index, offsets, entries_size, entry_offset) != (ssize_t)entries_size ||
+        pwrite(index, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        perror("Error updating treasure index");
+    }
+    close(index);
+}
+
+// Function to write a run index (spatial.idx or clues.idx, see
+// hunt_spatial.h) with entries as its only run, for the treasure file with
+// the given inode and data_end
+int save_run_index(const char *index_path, const char *magic, const SpatialEntry *entries, uint64_t count,
+                   uint64_t data_inode, uint64_t data_end)
+{
+    char temp_path[MAX_STRING + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", index_path);
+
+    SpatialIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, 4);
+    header.version = SPATIAL_FORMAT_VERSION;
+    header.run_count = count > 0 ? 1 : 0;
+    header.data_inode = data_inode;
+    header.data_size = data_end;
+    header.runs[0].offset = sizeof(header);
+    header.runs[0].count = count;
+    header.file_end = sizeof(header) + count * sizeof(SpatialEntry);
+
+    int file = mkstemp(temp_path);
+    if (file == -1)
+    {
+        perror("Error creating index");
+        return -1;
+    }
+    fchmod(file, 0644);
+    size_t entries_size = (size_t)count * sizeof(SpatialEntry);
+    if (write(file, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+        write(file, entries, entries_size) != (ssize_t)entries_size)
+    {
+        perror("Error writing index");
+        close(file);
+        unlink(temp_path);
+        return -1;
+    }
+    close(file);
+
+    // Like treasures.idx, the index is rebuilt whenever it does not match,
+    // so it needs no sync
+    if (rename(temp_path, index_path) != 0)
+    {
+        perror("Error replacing index");
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to rebuild spatial.idx from the treasure file itself.
+// The caller must hold the hunt lock. Returns 0 on success.
+int rebuild_spatial_index(const char *hunt_id)
+{
+    TreasureView view;
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &view) != 0 || view.legacy)
+    {
+        // Records of the original format have no offsets to index
+        treasure_view_close(&view);
+        unlink(get_spatial_file_path(hunt_id));
+        return -1;
+    }
+
+    SpatialEntry *entries = malloc((size_t)(view.live_count > 0 ? view.live_count : 1) * sizeof(SpatialEntry));
+    if (!entries)
+    {
+        perror("Error allocating spatial index");
+        treasure_view_close(&view);
+        return -1;
+    }
+
+    TreasureCursor cursor;
+    Treasure treasure;
+    uint64_t count = 0;
+    treasure_cursor_init(&view, &cursor);
+    while (count < (uint64_t)view.live_count && treasure_view_next(&view, &cursor, &treasure))
+    {
+        entries[count].key = spatial_key(treasure.latitude, treasure.longitude);
+        entries[count].offset = cursor.record_offset;
+        count++;
+    }
+    qsort(entries, (size_t)count, sizeof(SpatialEntry), spatial_compare_entries);
+
+    int result = save_run_index(get_spatial_file_path(hunt_id), SPATIAL_MAGIC, entries, count, view.inode, view.size);
+    free(entries);
+    treasure_view_close(&view);
+    return result;
+}
+
+// Function to rewrite a run index without its merged-away runs: the live
+// runs are copied as they are, followed by run, so nothing is sorted
+// again. The new file replaces the old one, which readers may still have
+// mapped. Returns 0 on success.
+static int rewrite_run_index(const char *index_path, int file, SpatialIndexHeader *header, const SpatialEntry *run,
+                             uint64_t run_count)
+{
+    char temp_path[MAX_STRING + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", index_path);
+    int rewritten = mkstemp(temp_path);
+    char *buffer = malloc(EXPORT_BUFFER_SIZE);
+    if (rewritten == -1 || !buffer)
+    {
+        perror("Error rewriting index");
+        if (rewritten != -1)
+        {
+            close(rewritten);
+            unlink(temp_path);
+        }
+        free(buffer);
+        return -1;
+    }
+    fchmod(rewritten, 0644);
+
+    uint64_t end = sizeof(*header);
+    int failed = 0;
+    for (uint32_t i = 0; i < header->run_count && !failed; i++)
+    {
+        uint64_t size = header->runs[i].count * sizeof(SpatialEntry);
+        for (uint64_t done = 0; done < size && !failed; done += EXPORT_BUFFER_SIZE)
+        {
+            size_t chunk = size - done < EXPORT_BUFFER_SIZE ? (size_t)(size - done) : EXPORT_BUFFER_SIZE;
+            failed = pread(file, buffer, chunk, (off_t)(header->runs[i].offset + done)) != (ssize_t)chunk ||
+                     pwrite(rewritten, buffer, chunk, (off_t)(end + done)) != (ssize_t)chunk;
+        }
+        header->runs[i].offset = end;
+        end += size;
+    }
+    free(buffer);
+
+    size_t run_size = (size_t)run_count * sizeof(SpatialEntry);
+    header->runs[header->run_count].offset = end;
+    header->runs[header->run_count].count = run_count;
+    header->run_count++;
+    header->file_end = end + run_size;
+    if (failed || pwrite(rewritten, run, run_size, (off_t)end) != (ssize_t)run_size ||
+        pwrite(rewritten, header, sizeof(*header), 0) != (ssize_t)sizeof(*header))
+    {
+        perror("Error rewriting index");
+        close(rewritten);
+        unlink(temp_path);
+        return -1;
+    }
+    close(rewritten);
+    if (rename(temp_path, index_path) != 0)
+    {
+        perror("Error replacing index");
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to add a run of sorted entries for records appended to a
+// treasure file, which took it from old_end to new_end, to a run index.
+// While the last run is no larger, the two are merged. Takes ownership of
+// the malloc'ed run. Returns -1 when the index must be rebuilt instead:
+// it was not up to date before the append, or could not be updated. The
+// caller must hold the hunt lock.
+int append_index_run(const char *index_path, const char *magic, uint64_t data_inode, uint64_t old_end,
+                     uint64_t new_end, SpatialEntry *run, uint64_t run_count)
+{
+    int file = open(index_path, O_RDWR);
+    SpatialIndexHeader header;
+    struct stat st;
+    if (file == -1 || fstat(file, &st) != 0 ||
+        pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        !spatial_header_valid(&header, (size_t)st.st_size, magic) || header.data_inode != data_inode ||
+        header.data_size != old_end)
+    {
+        if (file != -1)
+        {
+            close(file);
+        }
+        free(run);
+        return -1;
+    }
+
+    while (header.run_count > 0 && header.runs[header.run_count - 1].count <= run_count)
+    {
+        SpatialRun *last = &header.runs[header.run_count - 1];
+        size_t last_size = (size_t)last->count * sizeof(SpatialEntry);
+        SpatialEntry *older = malloc(last_size ? last_size : 1);
+        SpatialEntry *merged = malloc((size_t)(last->count + run_count) * sizeof(SpatialEntry));
+        if (!older || !merged || pread(file, older, last_size, (off_t)last->offset) != (ssize_t)last_size)
+        {
+            free(older);
+            free(merged);
+            free(run);
+            close(file);
+            return -1;
+        }
+
+        uint64_t i = 0, j = 0, n = 0;
+        while (i < last->count || j < run_count)
+        {
+            if (j == run_count || (i < last->count && spatial_compare_entries(&older[i], &run[j]) <= 0))
+            {
+                merged[n++] = older[i++];
+            }
+            else
+            {
+                merged[n++] = run[j++];
+            }
+        }
+        free(older);
+        free(run);
+        run = merged;
+        run_count = n;
+        header.run_count--;
+    }
+
+    // Rewrite the whole index once merged-away runs take up half of it
+    uint64_t live = run_count;
+    for (uint32_t i = 0; i < header.run_count; i++)
+    {
+        live += header.runs[i].count;
+    }
+    uint64_t dead = header.file_end - sizeof(header) - (live - run_count) * sizeof(SpatialEntry);
+    if (header.run_count == SPATIAL_MAX_RUNS)
+    {
+        free(run);
+        close(file);
+        return -1;
+    }
+    if (dead > live * sizeof(SpatialEntry))
+    {
+        header.data_size = new_end;
+        int result = rewrite_run_index(index_path, file, &header, run, run_count);
+        free(run);
+        close(file);
+        return result;
+    }
+
+    // The run goes past file_end, so readers of the current header are not disturbed
+    size_t run_size = (size_t)run_count * sizeof(SpatialEntry);
+    if (pwrite(file, run, run_size, (off_t)header.file_end) != (ssize_t)run_size)
+    {
+        perror("Error writing index");
+        free(run);
+        close(file);
+        return -1;
+    }
+    free(run);
+
+    header.runs[header.run_count].offset = header.file_end;
+    header.runs[header.run_count].count = run_count;
+    header.run_count++;
+    header.file_end += run_size;
+    header.data_size = new_end;
+    if (pwrite(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        perror("Error updating index");
+    }
+    close(file);
+    return 0;
+}
+
+// Function to index treasures appended at offsets, which took the
+// treasure file from old_end to new_end. The new entries become a run of
+// their own (see append_index_run). The caller must hold the hunt lock.
+void update_spatial_index(const char *hunt_id, uint64_t data_inode, uint64_t old_end, uint64_t new_end,
+                          const Treasure *batch, const uint64_t *offsets, int count)
+{
+    SpatialEntry *run = malloc((size_t)(count ? count : 1) * sizeof(SpatialEntry));
+    if (!run)
+    {
+        rebuild_spatial_index(hunt_id);
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        run[i].key = spatial_key(batch[i].latitude, batch[i].longitude);
+        run[i].offset = offsets[i];
+    }
+    qsort(run, (size_t)count, sizeof(SpatialEntry), spatial_compare_entries);
+
+    if (append_index_run(get_spatial_file_path(hunt_id), SPATIAL_MAGIC, data_inode, old_end, new_end, run,
+                         (uint64_t)count) != 0)
+    {
+        rebuild_spatial_index(hunt_id);
+    }
+}
+
+// Function to add the words of a treasure's clue to entries, which needs
+// room for CLUE_MAX_WORDS more. Returns the number of entries added.
+static uint64_t clue_entries(const Treasure *t, uint64_t offset, SpatialEntry *entries)
+{
+    uint64_t hashes[CLUE_MAX_WORDS];
+    int count = clue_word_hashes(t->clue, hashes);
+    for (int i = 0; i < count; i++)
+    {
+        entries[i].key = hashes[i];
+        entries[i].offset = offset;
+    }
+    return (uint64_t)count;
+}
+
+// Function to rebuild clues.idx from the treasure file itself.
+// The caller must hold the hunt lock. Returns 0 on success.
+int rebuild_clue_index(const char *hunt_id)
+{
+    TreasureView view;
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &view) != 0 || view.legacy)
+    {
+        // Records of the original format have no offsets to index
+        treasure_view_close(&view);
+        unlink(get_clue_file_path(hunt_id));
+        return -1;
+    }
+
+    uint64_t capacity = (uint64_t)view.live_count * 8 + CLUE_MAX_WORDS;
+    SpatialEntry *entries = malloc((size_t)capacity * sizeof(SpatialEntry));
+    TreasureCursor cursor;
+    Treasure treasure;
+    uint64_t count = 0;
+    treasure_cursor_init(&view, &cursor);
+    while (entries && treasure_view_next(&view, &cursor, &treasure))
+    {
+        if (capacity - count < CLUE_MAX_WORDS)
+        {
+            capacity *= 2;
+            SpatialEntry *grown = realloc(entries, (size_t)capacity * sizeof(SpatialEntry));
+            if (!grown)
+            {
+                free(entries);
+                entries = NULL;
+                break;
+            }
+            entries = grown;
+        }
+        count += clue_entries(&treasure, cursor.record_offset, entries + count);
+    }
+    if (!entries)
+    {
+        perror("Error allocating clue index");
+        treasure_view_close(&view);
+        return -1;
+    }
+    qsort(entries, (size_t)count, sizeof(SpatialEntry), spatial_compare_entries);
+
+    int result = save_run_index(get_clue_file_path(hunt_id), CLUE_INDEX_MAGIC, entries, count, view.inode, view.size);
+    free(entries);
+    treasure_view_close(&view);
+    return result;
+}
+
+// Function to index the clues of treasures appended at offsets, like
+// update_spatial_index(). The caller must hold the hunt lock.
+void update_clue_index(const char *hunt_id, uint64_t data_inode, uint64_t old_end, uint64_t new_end,
+                       const Treasure *batch, const uint64_t *offsets, int count)
+{
+    uint64_t capacity = (uint64_t)count * 8 + CLUE_MAX_WORDS;
+    uint64_t run_count = 0;
+    SpatialEntry *run = malloc((size_t)capacity * sizeof(SpatialEntry));
+    for (int i = 0; run && i < count; i++)
+    {
+        if (capacity - run_count < CLUE_MAX_WORDS)
+        {
+            capacity *= 2;
+            SpatialEntry *grown = realloc(run, (size_t)capacity * sizeof(SpatialEntry));
+            if (!grown)
+            {
+                free(run);
+                run = NULL;
+                break;
+            }
+            run = grown;
+        }
+        run_count += clue_entries(&batch[i], offsets[i], run + run_count);
+    }
+    if (!run)
+    {
+        rebuild_clue_index(hunt_id);
+        return;
+    }
+    qsort(run, (size_t)run_count, sizeof(SpatialEntry), spatial_compare_entries);
+
+    if (append_index_run(get_clue_file_path(hunt_id), CLUE_INDEX_MAGIC, data_inode, old_end, new_end, run,
+                         run_count) != 0)
+    {
+        rebuild_clue_index(hunt_id);
+    }
+}
+
+// Function to open a hunt's treasure file for appending, creating it or
+// converting it to the current format first when needed. Bytes left past
+// data_end by an interrupted append are discarded. The caller must hold the
+// hunt lock. Returns the descriptor and the current header, or -1.
+int open_treasures_for_append(const char *hunt_id, TreasureFileHeader *header)
+{
+    char *file_path = get_treasure_file_path(hunt_id);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int file = open(file_path, O_RDWR | O_CREAT, 0644);
+        struct stat st;
+        if (file == -1 || fstat(file, &st) != 0)
+        {
+            perror("Error opening treasure file");
+            if (file != -1)
+            {
+                close(file);
+            }
+            return -1;
+        }
+
+        if (st.st_size == 0)
+        {
+            treasure_header_init(header, 0, 1, sizeof(*header));
+            if (pwrite(file, header, sizeof(*header), 0) != (ssize_t)sizeof(*header))
+            {
+                perror("Error writing treasure file header");
+                close(file);
+                return -1;
+            }
+            return file;
+        }
+
+        if (pread(file, header, sizeof(*header), 0) == (ssize_t)sizeof(*header) &&
+            memcmp(header->magic, TREASURE_MAGIC, 4) == 0 &&
+            header->version == TREASURE_FORMAT_VERSION &&
+            header->data_end >= sizeof(*header) && header->data_end <= (uint64_t)st.st_size)
+        {
+            if ((uint64_t)st.st_size > header->data_end)
+            {
+                fprintf(stderr, "Recovered hunt %s: discarded %lld bytes of an unfinished write\n",
+                        hunt_id, (long long)((uint64_t)st.st_size - header->data_end));
+                if (ftruncate(file, (off_t)header->data_end) != 0)
+                {
+                    perror("Error truncating treasure file");
+                    close(file);
+                    return -1;
+                }
+            }
+            return file;
+        }
+
+        // Older formats are rewritten once, then appended to
+        close(file);
+        Hunt *migrated = load_treasures(hunt_id);
+        if (!migrated)
+        {
+            break; // Unreadable or not rewritten, so left in its old format
+        }
+        hunt_free(migrated);
+    }
+
+    fprintf(stderr, "Treasure file for hunt %s cannot be appended to\n", hunt_id);
+    return -1;
+}
+
+// Function to append treasures to a hunt. IDs are assigned from the file's
+// next_id and stored in batch. The records are written with one call and
+// only become visible when the header's data_end is moved past them, so a
+// crash never leaves a half-written record behind. The caller must hold
+// the hunt lock. Returns 0 on success.
+int append_treasures(const char *hunt_id, Treasure *batch, int count)
+{
+    TreasureFileHeader header;
+    int file = open_treasures_for_append(hunt_id, &header);
+    if (file == -1)
+    {
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += treasure_encoded_size(&batch[i]);
+    }
+
+    unsigned char *buffer = malloc(total ? total : 1);
+    uint64_t *offsets = malloc((size_t)(count ? count : 1) * sizeof(uint64_t));
+    if (!buffer || !offsets)
+    {
+        perror("Error allocating treasure buffer");
+        free(buffer);
+        free(offsets);
+        close(file);
+        return -1;
+    }
+
+    uint64_t old_end = header.data_end;
+    uint32_t old_live_count = header.live_count;
+    int first_id = (int)header.next_id;
+    long long added_value = 0;
+    size_t used = 0;
+    for (int i = 0; i < count; i++)
+    {
+        added_value += batch[i].value;
+        batch[i].id = (int)header.next_id++;
+        offsets[i] = old_end + used;
+        used += treasure_encode(&batch[i], buffer + used);
+    }
+
+    if (pwrite(file, buffer, total, (off_t)old_end) != (ssize_t)total)
+    {
+        perror("Error appending treasures");
+        free(buffer);
+        free(offsets);
+        close(file);
+        return -1;
+    }
+    free(buffer);
+
+    // The records must be on disk before the header points at them
+    durable_barrier(file);
+
+    header.record_count += (uint32_t)count;
+    header.live_count += (uint32_t)count;
+    header.data_end += total;
+    struct stat st;
+    if (pwrite(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fstat(file, &st) != 0)
+    {
+        perror("Error updating treasure file header");
+        free(offsets);
+        close(file);
+        return -1;
+    }
+    durable_commit(file);
+    close(file);
+
+    append_treasure_index(hunt_id, first_id, offsets, count, (uint64_t)st.st_ino, old_end, header.data_end);
+    update_spatial_index(hunt_id, (uint64_t)st.st_ino, old_end, header.data_end, batch, offsets, count);
+    update_clue_index(hunt_id, (uint64_t)st.st_ino, old_end, header.data_end, batch, offsets, count);
+    free(offsets);
+    update_catalog(hunt_id, (int)header.live_count, added_value);
+
+    ScoreSource before = {(uint64_t)st.st_ino, old_end, old_live_count};
+    ScoreSource after = {(uint64_t)st.st_ino, header.data_end, header.live_count};
+    update_scores(hunt_id, &before, &after, batch, count, 1);
+    return 0;
+}
+
+// Function to save treasures to file. Returns 0 on success, -1 if the old
+// file was left in place.
+int save_treasures(const char *hunt_id, Hunt *hunt)
+{
+    char *file_path = get_treasure_file_path(hunt_id);
+
+    // Encode the whole hunt first so the file is written with a single call
+    size_t total = sizeof(TreasureFileHeader);
+    for (int i = 0; i < hunt->treasure_count; i++)
+    {
+        total += treasure_encoded_size(&hunt->treasures[i]);
+    }
+
+    unsigned char *buffer = malloc(total);
+    if (!buffer)
+    {
+        perror("Error allocating treasure buffer");
+        return -1;
+    }
+
+    // Record where every ID lands for the index
+    uint32_t entry_count = 0;
+    for (int i = 0; i < hunt->treasure_count; i++)
+    {
+        if (hunt->treasures[i].id > 0 && (uint32_t)hunt->treasures[i].id > entry_count)
+        {
+            entry_count = (uint32_t)hunt->treasures[i].id;
+        }
+    }
+    if (hunt->next_id <= (int)entry_count)
+    {
+        hunt->next_id = (int)entry_count + 1;
+    }
+
+    TreasureFileHeader header;
+    treasure_header_init(&header, (uint32_t)hunt->treasure_count, (uint32_t)hunt->next_id, total);
+    memcpy(buffer, &header, sizeof(header));
+    uint64_t *offsets = calloc(entry_count ? entry_count : 1, sizeof(uint64_t));
+    if (!offsets)
+    {
+        perror("Error allocating treasure index");
+        free(buffer);
+        return -1;
+    }
+
+    size_t offset = sizeof(header);
+    for (int i = 0; i < hunt->treasure_count; i++)
+    {
+        if (hunt->treasures[i].id > 0)
+        {
+            offsets[hunt->treasures[i].id - 1] = offset;
+        }
+        offset += treasure_encode(&hunt->treasures[i], buffer + offset);
+    }
+
+    // Write a new file and rename it over the old one, so processes that
+    // have the old file mapped keep a consistent copy instead of a truncated
+    // one and a crash leaves either the old or the new file
+    char temp_path[MAX_STRING + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", file_path);
+    int file = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (file == -1)
+    {
+        perror("Error opening treasure file for writing");
+        free(offsets);
+        free(buffer);
+        return -1;
+    }
+
+    struct stat st;
+    if (write(file, buffer, total) != (ssize_t)total || fstat(file, &st) != 0)
+    {
+        perror("Error writing treasure file");
+        close(file);
+        unlink(temp_path);
+        free(offsets);
+        free(buffer);
+        return -1;
+    }
+
+    free(buffer);
+
+    // The index names the new file's inode, so it is only trusted once the rename lands
+    save_treasure_index(hunt_id, offsets, entry_count, (uint64_t)st.st_ino, total);
+    free(offsets);
+
+    int result = durable_replace(file, temp_path, file_path);
+    close(file);
+    return result;
+}
+
+// Function to load treasures from file; the caller releases the hunt with hunt_free().
+// Returns NULL if the file cannot be read whole, so no caller ever writes
+// back a hunt missing the records past a damaged one, or if it needed
+// migrating and the rewrite failed.
+Hunt *load_treasures(const char *hunt_id)
+{
+    Hunt *hunt = hunt_create(hunt_id);
+    if (!hunt)
+    {
+        perror("Error allocating hunt");
+        exit(EXIT_FAILURE);
+    }
+
+    char *file_path = get_treasure_file_path(hunt_id);
+    int file = open(file_path, O_RDONLY);
+
+    if (file == -1)
+    {
+        return hunt; // Return empty hunt if file doesn't exist
+    }
+
+    int outdated = 0;
+    if (treasure_read_all(file, hunt, &outdated) != 0)
+    {
+        fprintf(stderr, "Error: treasure file for hunt %s is corrupt after %d treasures, leaving it as it is\n",
+                hunt_id, hunt->treasure_count);
+        close(file);
+        hunt_free(hunt);
+        return NULL;
+    }
+    close(file);
+
+    // One-time migration of raw-struct and older versioned files. Only
+    // reached when every record was read, so nothing is dropped.
+    if (outdated)
+    {
+        if (save_treasures(hunt_id, hunt) != 0)
+        {
+            fprintf(stderr, "Failed to migrate hunt %s to treasure format v%d, leaving it as it is\n", hunt_id,
+                    TREASURE_FORMAT_VERSION);
+            hunt_free(hunt);
+            return NULL;
+        }
+        fprintf(stderr, "Migrated hunt %s to treasure format v%d\n", hunt_id, TREASURE_FORMAT_VERSION);
+    }
+
+    return hunt;
+}
+
+// Function to read hunt/catalog.dat. Returns the number of entries (stored
+// in *entries, to be freed by the caller) or -1 if there is no valid catalog.
+int load_catalog(CatalogEntry **entries)
+{
+    *entries = NULL;
+    int file = open(CATALOG_FILE, O_RDONLY);
+    if (file == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    unsigned char *data = NULL;
+    if (fstat(file, &st) != 0 || st.st_size < (off_t)sizeof(HuntCatalogHeader) ||
+        !(data = malloc((size_t)st.st_size)) ||
+        read(file, data, (size_t)st.st_size) != (ssize_t)st.st_size)
+    {
+        free(data);
+        close(file);
+        return -1;
+    }
+    close(file);
+
+    HuntCatalogHeader header;
+    memcpy(&header, data, sizeof(header));
+    CatalogEntry *list = NULL;
+    if (memcmp(header.magic, HUNT_CATALOG_MAGIC, 4) != 0 || header.version != HUNT_CATALOG_VERSION ||
+        !(list = malloc((header.entry_count ? header.entry_count : 1) * sizeof(CatalogEntry))))
+    {
+        free(data);
+        return -1;
+    }
+
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.entry_count; i++)
+    {
+        HuntCatalogRecord record;
+        if ((size_t)st.st_size - offset < sizeof(record))
+        {
+            break;
+        }
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record.id_len >= MAX_STRING || (size_t)st.st_size - offset < record.id_len)
+        {
+            break;
+        }
+        memcpy(list[i].hunt_id, data + offset, record.id_len);
+        list[i].hunt_id[record.id_len] = '\0';
+        list[i].live_count = (int)record.live_count;
+        list[i].total_value = record.total_value;
+        list[i].modified = (time_t)record.modified;
+        offset += record.id_len;
+        if (i + 1 == header.entry_count)
+        {
+            free(data);
+            *entries = list;
+            return (int)header.entry_count;
+        }
+    }
+
+    free(data);
+    if (header.entry_count == 0)
+    {
+        *entries = list;
+        return 0;
+    }
+    free(list); // Truncated catalog
+    return -1;
+}
+
+// Function to write hunt/catalog.dat, replacing it atomically
+void save_catalog(const CatalogEntry *entries, int count)
+{
+    size_t total = sizeof(HuntCatalogHeader);
+    for (int i = 0; i < count; i++)
+    {
+        total += sizeof(HuntCatalogRecord) + strlen(entries[i].hunt_id);
+    }
+
+    unsigned char *buffer = malloc(total);
+    if (!buffer)
+    {
+        perror("Error allocating catalog buffer");
+        return;
+    }
+
+    HuntCatalogHeader header;
+    memcpy(header.magic, HUNT_CATALOG_MAGIC, 4);
+    header.version = HUNT_CATALOG_VERSION;
+    header.entry_count = (uint32_t)count;
+    header.reserved = 0;
+    memcpy(buffer, &header, sizeof(header));
+
+    size_t offset = sizeof(header);
+    for (int i = 0; i < count; i++)
+    {
+        HuntCatalogRecord record;
+        record.live_count = (uint32_t)entries[i].live_count;
+        record.id_len = (uint32_t)strlen(entries[i].hunt_id);
+        record.total_value = entries[i].total_value;
+        record.modified = (int64_t)entries[i].modified;
+        memcpy(buffer + offset, &record, sizeof(record));
+        offset += sizeof(record);
+        memcpy(buffer + offset, entries[i].hunt_id, record.id_len);
+        offset += record.id_len;
+    }
+
+    char temp_path[] = "hunt/catalog.dat.XXXXXX";
+    int file = mkstemp(temp_path);
+    if (file == -1)
+    {
+        perror("Error creating catalog");
+        free(buffer);
+        return;
+    }
+    fchmod(file, 0644);
+    if (write(file, buffer, total) != (ssize_t)total)
+    {
+        perror("Error writing catalog");
+        close(file);
+        unlink(temp_path);
+        free(buffer);
+        return;
+    }
+    free(buffer);
+    durable_replace(file, temp_path, CATALOG_FILE);
+    close(file);
+}
+
+// Function to take the lock that serializes catalog updates.
+// Returns the descriptor to close() to release it, or -1.
+int lock_catalog()
+{
+    int lock = open("hunt", O_RDONLY | O_DIRECTORY);
+    if (lock != -1 && flock(lock, LOCK_EX) != 0)
+    {
+        perror("Error locking catalog");
+    }
+    return lock;
+}
+
+static int compare_catalog_entries(const void *a, const void *b)
+{
+    return strcmp(((const CatalogEntry *)a)->hunt_id, ((const CatalogEntry *)b)->hunt_id);
+}
+
+// Function to build the catalog from the hunts themselves. Returns the
+// number of entries (stored in *entries) or -1.
+int scan_catalog(CatalogEntry **entries)
+{
+    *entries = NULL;
+    DIR *hunt_dir = opendir("hunt");
+    if (!hunt_dir)
+    {
+        return -1;
+    }
+
+    int count = 0, capacity = 0;
+    CatalogEntry *list = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(hunt_dir)) != NULL)
+    {
+        if (entry->d_type != DT_DIR || strncmp(entry->d_name, "hunt", 4) != 0)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : HUNT_INITIAL_CAPACITY;
+            CatalogEntry *grown = realloc(list, (size_t)capacity * sizeof(CatalogEntry));
+            if (!grown)
+            {
+                free(list);
+                closedir(hunt_dir);
+                return -1;
+            }
+            list = grown;
+        }
+
+        CatalogEntry *item = &list[count++];
+        memset(item, 0, sizeof(*item));
+        snprintf(item->hunt_id, sizeof(item->hunt_id), "%s", entry->d_name + 4);
+
+        struct stat st;
+        TreasureView view;
+        if (stat(get_treasure_file_path(item->hunt_id), &st) == 0 &&
+            treasure_view_open(get_treasure_file_path(item->hunt_id), &view) == 0)
+        {
+            // The count comes from the header, as the incremental updates do
+            TreasureCursor cursor;
+            Treasure t;
+            treasure_cursor_init(&view, &cursor);
+            while (treasure_view_next(&view, &cursor, &t))
+            {
+                item->total_value += t.value;
+            }
+            item->live_count = view.live_count;
+            item->modified = st.st_mtime;
+            treasure_view_close(&view);
+        }
+    }
+    closedir(hunt_dir);
+
+    if (count > 1)
+    {
+        qsort(list, (size_t)count, sizeof(CatalogEntry), compare_catalog_entries);
+    }
+    *entries = list;
+    return count;
+}
+
+// Function to load the catalog, rebuilding it first if it is missing or
+// damaged. Takes the catalog lock when it has to rebuild.
+int read_catalog(CatalogEntry **entries)
+{
+    int count = load_catalog(entries);
+    if (count >= 0)
+    {
+        return count;
+    }
+
+    int lock = lock_catalog();
+    count = load_catalog(entries); // Someone else may have rebuilt it meanwhile
+    if (count < 0)
+    {
+        count = scan_catalog(entries);
+        if (count >= 0)
+        {
+            save_catalog(*entries, count);
+        }
+    }
+    if (lock != -1)
+    {
+        close(lock);
+    }
+    return count;
+}
+
+// Function to change a hunt's catalog entry after a write: live_count is
+// the hunt's new number of treasures and value_delta the change in total value
+void change_catalog(const char *hunt_id, int remove, int live_count, long long value_delta)
+{
+    int lock = lock_catalog();
+    CatalogEntry *entries;
+    int count = load_catalog(&entries);
+    if (count < 0)
+    {
+        // The scan already sees this change
+        count = scan_catalog(&entries);
+        if (count >= 0)
+        {
+            save_catalog(entries, count);
+        }
+        free(entries);
+        if (lock != -1)
+        {
+            close(lock);
+        }
+        return;
+    }
+
+    int found = -1;
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(entries[i].hunt_id, hunt_id) == 0)
+        {
+            found = i;
+            break;
+        }
+    }
+
+    if (remove)
+    {
+        if (found >= 0)
+        {
+            memmove(&entries[found], &entries[found + 1], (size_t)(count - found - 1) * sizeof(CatalogEntry));
+            count--;
+        }
+    }
+    else
+    {
+        if (found < 0)
+        {
+            CatalogEntry *grown = realloc(entries, (size_t)(count + 1) * sizeof(CatalogEntry));
+            if (!grown)
+            {
+                perror("Error updating catalog");
+                free(entries);
+                if (lock != -1)
+                {
+                    close(lock);
+                }
+                return;
+            }
+            entries = grown;
+            found = count++;
+            memset(&entries[found], 0, sizeof(CatalogEntry));
+            snprintf(entries[found].hunt_id, sizeof(entries[found].hunt_id), "%s", hunt_id);
+            qsort(entries, (size_t)count, sizeof(CatalogEntry), compare_catalog_entries);
+            for (found = 0; strcmp(entries[found].hunt_id, hunt_id) != 0; found++)
+            {
+            }
+        }
+        entries[found].live_count = live_count;
+        entries[found].total_value += value_delta;
+        entries[found].modified = time(NULL);
+    }
+
+    save_catalog(entries, count);
+    free(entries);
+    if (lock != -1)
+    {
+        close(lock);
+    }
+}
+
+// Function to record a hunt's new treasure count and value change in the catalog
+void update_catalog(const char *hunt_id, int live_count, long long value_delta)
+{
+    change_catalog(hunt_id, 0, live_count, value_delta);
+}
+
+// Function to drop a removed hunt from the catalog
+void remove_from_catalog(const char *hunt_id)
+{
+    change_catalog(hunt_id, 1, 0, 0);
+}
+
+// Function to write scores.dat from a complete score table of the treasure
+// file contents identified by source, replacing it atomically. The users
+// are stored sorted by username. Returns 0 on success.
+int save_scores(const char *hunt_id, HuntScores *scores, const ScoreSource *source)
+{
+    // The slot table does not survive the reordering
+    free(scores->slots);
+    scores->slots = NULL;
+    qsort(scores->users, (size_t)scores->user_count, sizeof(UserScore), hunt_scores_compare_names);
+
+    size_t total = sizeof(ScoreFileHeader);
+    for (int i = 0; i < scores->user_count; i++)
+    {
+        total += sizeof(ScoreRecord) + scores->users[i].length + 1;
+    }
+
+    unsigned char *buffer = malloc(total);
+    if (!buffer)
+    {
+        perror("Error allocating score buffer");
+        return -1;
+    }
+
+    ScoreFileHeader header;
+    memcpy(header.magic, SCORE_MAGIC, 4);
+    header.version = SCORE_FORMAT_VERSION;
+    header.user_count = (uint32_t)scores->user_count;
+    header.source_live_count = source->live_count;
+    header.base_end = total;
+    header.data_end = total;
+    header.source_inode = source->inode;
+    header.source_end = source->end;
+    memcpy(buffer, &header, sizeof(header));
+
+    size_t offset = sizeof(header);
+    for (int i = 0; i < scores->user_count; i++)
+    {
+        offset += score_record_encode(buffer + offset, scores->users[i].username, scores->users[i].total_score,
+                                      scores->users[i].treasure_count);
+    }
+
+    char temp_path[MAX_STRING + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", get_scores_file_path(hunt_id));
+    int file = mkstemp(temp_path);
+    if (file == -1)
+    {
+        perror("Error creating score table");
+        free(buffer);
+        return -1;
+    }
+    fchmod(file, 0644);
+    if (write(file, buffer, total) != (ssize_t)total)
+    {
+        perror("Error writing score table");
+        close(file);
+        unlink(temp_path);
+        free(buffer);
+        return -1;
+    }
+    free(buffer);
+    int result = durable_replace(file, temp_path, get_scores_file_path(hunt_id));
+    close(file);
+    return result;
+}
+
+// Function to recompute scores.dat from the treasure file. The caller must
+// hold the hunt lock. Returns 0 on success.
+int rebuild_scores(const char *hunt_id)
+{
+    TreasureView view;
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &view) != 0)
+    {
+        unlink(get_scores_file_path(hunt_id));
+        return -1;
+    }
+
+    HuntScores scores;
+    if (hunt_scores_compute(&view, &scores) != 0)
+    {
+        perror("Error computing scores");
+        treasure_view_close(&view);
+        return -1;
+    }
+    ScoreSource source;
+    score_source_of_view(&view, &source);
+    int result = save_scores(hunt_id, &scores, &source);
+    hunt_scores_free(&scores);
+    treasure_view_close(&view);
+    return result;
+}
+
+// Function to fold the delta records of scores.dat into a new sorted table
+void fold_scores(const char *hunt_id)
+{
+    ScoreFile file;
+    if (score_file_read(get_scores_file_path(hunt_id), &file) != 0)
+    {
+        return;
+    }
+    ScoreSource source = {file.header.source_inode, file.header.source_end, file.header.source_live_count};
+    save_scores(hunt_id, &file.scores, &source);
+    score_file_free(&file);
+}
+
+// Function to bring scores.dat up to date after a write that took the
+// treasure file from before to after by adding (sign 1) or removing
+// (sign -1) changes. The change of each user is appended as a delta record,
+// so the cost depends on the write, not on the hunt size. A table that does
+// not describe before missed a write and is rebuilt instead. The caller
+// must hold the hunt lock.
+void update_scores(const char *hunt_id, const ScoreSource *before, const ScoreSource *after,
+                   const Treasure *changes, int count, int sign)
+{
+    int file = open(get_scores_file_path(hunt_id), O_RDWR);
+    ScoreFileHeader header;
+    if (file == -1 || pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, SCORE_MAGIC, 4) != 0 || header.version != SCORE_FORMAT_VERSION ||
+        header.base_end < sizeof(header) || header.data_end < header.base_end ||
+        !score_file_describes(&header, before))
+    {
+        if (file != -1)
+        {
+            close(file);
+        }
+        rebuild_scores(hunt_id);
+        return;
+    }
+
+    HuntScores delta;
+    if (hunt_scores_init(&delta) != 0)
+    {
+        close(file);
+        rebuild_scores(hunt_id);
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (hunt_scores_add(&delta, changes[i].username, sign * changes[i].value, sign) != 0)
+        {
+            close(file);
+            rebuild_scores(hunt_id);
+            return;
+        }
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < delta.user_count; i++)
+    {
+        total += sizeof(ScoreRecord) + delta.users[i].length + 1;
+    }
+    unsigned char *buffer = malloc(total ? total : 1);
+    if (!buffer)
+    {
+        hunt_scores_free(&delta);
+        close(file);
+        rebuild_scores(hunt_id);
+        return;
+    }
+    size_t used = 0;
+    for (int i = 0; i < delta.user_count; i++)
+    {
+        used += score_record_encode(buffer + used, delta.users[i].username, delta.users[i].total_score,
+                                    delta.users[i].treasure_count);
+    }
+    hunt_scores_free(&delta);
+
+    // Like treasure records, the deltas only count once the header covers them
+    if (pwrite(file, buffer, total, (off_t)header.data_end) != (ssize_t)total)
+    {
+        perror("Error appending score deltas");
+        free(buffer);
+        close(file);
+        rebuild_scores(hunt_id);
+        return;
+    }
+    free(buffer);
+    durable_barrier(file);
+
+    header.data_end += total;
+    header.source_inode = after->inode;
+    header.source_end = after->end;
+    header.source_live_count = after->live_count;
+    if (pwrite(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        perror("Error updating score table header");
+        close(file);
+        rebuild_scores(hunt_id);
+        return;
+    }
+    durable_commit(file);
+    close(file);
+
+    // Readers add up every delta, so fold them once they outgrow the table
+    uint64_t delta_size = header.data_end - header.base_end;
+    uint64_t base_size = header.base_end - sizeof(header);
+    if (delta_size > SCORE_DELTA_MIN_FOLD && delta_size > base_size)
+    {
+        fold_scores(hunt_id);
+    }
+}
+
+// Function to add a new treasure
+void add_treasure(const char *hunt_id)
+{
+    create_hunt_directory(hunt_id);
+
+    Treasure new_treasure;
+    char username[MAX_STRING];
+    char clue[MAX_CLUE];
+    char input_buffer[MAX_STRING];
+
+    printf("Enter username: ");
+    if (fgets(username, sizeof(username), stdin) == NULL)
+    {
+        printf("Error reading username\n");
+        return;
+    }
+    username[strcspn(username, "\n")] = 0;
+
+    printf("Enter latitude: ");
+    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    {
+        printf("Error reading latitude\n");
+        return;
+    }
+    if (sscanf(input_buffer, "%lf", &new_treasure.latitude) != 1)
+    {
+        printf("Invalid latitude format\n");
+        return;
+    }
+
+    printf("Enter longitude: ");
+    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    {
+        printf("Error reading longitude\n");
+        return;
+    }
+    if (sscanf(input_buffer, "%lf", &new_treasure.longitude) != 1)
+    {
+        printf("Invalid longitude format\n");
+        return;
+    }
+
+    printf("Enter clue: ");
+    if (fgets(clue, sizeof(clue), stdin) == NULL)
+    {
+        printf("Error reading clue\n");
+        return;
+    }
+    clue[strcspn(clue, "\n")] = 0;
+
+    printf("Enter value: ");
+    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    {
+        printf("Error reading value\n");
+        return;
+    }
+    if (sscanf(input_buffer, "%d", &new_treasure.value) != 1)
+    {
+        printf("Invalid value format\n");
+        return;
+    }
+
+    new_treasure.username = username;
+    new_treasure.clue = clue;
+
+    // The treasure is appended, nothing else in the file is rewritten
+    int lock = lock_hunt(hunt_id);
+    int appended = append_treasures(hunt_id, &new_treasure, 1);
+    close(lock);
+    if (appended != 0)
+    {
+        printf("Error: Could not save treasure\n");
+        LogEvent failure = {LOG_OP_ADD, 1, 0, 0, 0, NULL, "Could not write treasure file"};
+        log_operation(hunt_id, &failure);
+        return;
+    }
+
+    LogEvent event = {LOG_OP_ADD, 0, new_treasure.id, new_treasure.value, 0, new_treasure.username, NULL};
+    log_operation(hunt_id, &event);
+    printf("\nTreasure added successfully with ID: %d\n", new_treasure.id);
+}
+
+// One treasure read from an import file, before validation
+typedef struct
+{
+    char username[MAX_STRING];
+    char clue[MAX_CLUE];
+    char latitude[64];
+    char longitude[64];
+    char value[32];
+    int fields; // IMPORT_FIELD_ bits of the fields present
+} ImportRecord;
+
+#define IMPORT_FIELD_USERNAME 1
+#define IMPORT_FIELD_LATITUDE 2
+#define IMPORT_FIELD_LONGITUDE 4
+#define IMPORT_FIELD_CLUE 8
+#define IMPORT_FIELD_VALUE 16
+#define IMPORT_FIELDS_ALL 31
+
+// Function to store a field of an import record. Returns 0, or -1 if the
+// value does not fit.
+static int set_import_field(ImportRecord *record, int field, const char *value, size_t length)
+{
+    char *dest;
+    size_t size;
+    switch (field)
+    {
+    case IMPORT_FIELD_USERNAME:
+        dest = record->username, size = sizeof(record->username);
+        break;
+    case IMPORT_FIELD_LATITUDE:
+        dest = record->latitude, size = sizeof(record->latitude);
+        break;
+    case IMPORT_FIELD_LONGITUDE:
+        dest = record->longitude, size = sizeof(record->longitude);
+        break;
+    case IMPORT_FIELD_CLUE:
+        dest = record->clue, size = sizeof(record->clue);
+        break;
+    case IMPORT_FIELD_VALUE:
+        dest = record->value, size = sizeof(record->value);
+        break;
+    default:
+        return 0;
+    }
+    if (length >= size)
+    {
+        return -1;
+    }
+    memcpy(dest, value, length);
+    dest[length] = '\0';
+    record->fields |= field;
+    return 0;
+}
+
+// Function to parse one CSV line (username,latitude,longitude,clue,value).
+// Fields may be quoted, with "" for a quote inside them.
+// Returns NULL on success or an error message.
+static const char *parse_csv_treasure(const char *line, ImportRecord *record)
+{
+    static const int order[] = {IMPORT_FIELD_USERNAME, IMPORT_FIELD_LATITUDE, IMPORT_FIELD_LONGITUDE,
+                                IMPORT_FIELD_CLUE, IMPORT_FIELD_VALUE};
+    char field[MAX_CLUE];
+    const char *p = line;
+    record->fields = 0;
+
+    for (int i = 0; i < 5; i++)
+    {
+        size_t length = 0;
+        if (*p == '"')
+        {
+            p++;
+            while (*p && !(*p == '"' && p[1] != '"'))
+            {
+                if (*p == '"')
+                {
+                    p++; // "" stands for one quote
+                }
+                if (length == sizeof(field) - 1)
+                {
+                    return "field too long";
+                }
+                field[length++] = *p++;
+            }
+            if (*p != '"')
+            {
+                return "unterminated quoted field";
+            }
+            p++;
+        }
+        else
+        {
+            while (*p && *p != ',')
+            {
+                if (length == sizeof(field) - 1)
+                {
+                    return "field too long";
+                }
+                field[length++] = *p++;
+            }
+        }
+        if (set_import_field(record, order[i], field, length) != 0)
+        {
+            return "field too long";
+        }
+
+        if (i < 4)
+        {
+            if (*p != ',')
+            {
+                return "expected 5 fields";
+            }
+            p++;
+        }
+    }
+    return *p == '\0' ? NULL : "expected 5 fields";
+}
+
+// Function to parse a JSON string starting at the opening quote into out
+// (UTF-8). Returns a pointer past the closing quote, or NULL.
+static const char *parse_json_string(const char *p, char *out, size_t out_size, size_t *length)
+{
+    size_t n = 0;
+    p++;
+    while (*p != '"')
+    {
+        unsigned int c = (unsigned char)*p++;
+        int escaped = c == '\\';
+        if (c == '\0')
+        {
+            return NULL;
+        }
+        if (escaped)
+        {
+            c = (unsigned char)*p++;
+            switch (c)
+            {
+            case 'n':
+                c = '\n';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'u':
+            {
+                char hex[5] = {0};
+                for (int i = 0; i < 4; i++)
+                {
+                    if (!isxdigit((unsigned char)p[i]))
+                    {
+                        return NULL;
+                    }
+                    hex[i] = p[i];
+                }
+                p += 4;
+                c = (unsigned int)strtoul(hex, NULL, 16);
+                break;
+            }
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            default:
+                return NULL;
+            }
+        }
+
+        // Code points from \u escapes take up to three UTF-8 bytes; other
+        // bytes are already UTF-8
+        unsigned char bytes[3];
+        int count;
+        if (c < 0x80 || !escaped)
+        {
+            bytes[0] = (unsigned char)c, count = 1;
+        }
+        else if (c < 0x800)
+        {
+            bytes[0] = (unsigned char)(0xC0 | (c >> 6)), bytes[1] = (unsigned char)(0x80 | (c & 0x3F)), count = 2;
+        }
+        else
+        {
+            bytes[0] = (unsigned char)(0xE0 | (c >> 12)), bytes[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[2] = (unsigned char)(0x80 | (c & 0x3F)), count = 3;
+        }
+        if (n + (size_t)count >= out_size)
+        {
+            return NULL;
+        }
+        memcpy(out + n, bytes, (size_t)count);
+        n += (size_t)count;
+    }
+    out[n] = '\0';
+    *length = n;
+    return p + 1;
+}
+
+static const char *skip_json_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+    {
+        p++;
+    }
+    return p;
+}
+
+// Function to parse one JSON Lines object with the keys username,
+// latitude, longitude, clue and value. Other keys are ignored.
+// Returns NULL on success or an error message.
+static const char *parse_jsonl_treasure(const char *line, ImportRecord *record)
+{
+    char key[32];
+    char value[MAX_CLUE];
+    size_t length;
+    const char *p = skip_json_space(line);
+    record->fields = 0;
+
+    if (*p++ != '{')
+    {
+        return "expected a JSON object";
+    }
+    p = skip_json_space(p);
+    if (*p == '}')
+    {
+        p++;
+    }
+    else
+    {
+        while (1)
+        {
+            if (*p != '"' || !(p = parse_json_string(p, key, sizeof(key), &length)))
+            {
+                return "bad key";
+            }
+            p = skip_json_space(p);
+            if (*p++ != ':')
+            {
+                return "expected ':'";
+            }
+            p = skip_json_space(p);
+
+            if (*p == '"')
+            {
+                if (!(p = parse_json_string(p, value, sizeof(value), &length)))
+                {
+                    return "bad or too long string";
+                }
+            }
+            else
+            {
+                // Numbers and literals are kept as text and checked later
+                length = strcspn(p, ",} \t\r");
+                if (length == 0 || length >= sizeof(value))
+                {
+                    return "bad value";
+                }
+                memcpy(value, p, length);
+                value[length] = '\0';
+                p += length;
+            }
+
+            int field = strcmp(key, "username") == 0    ? IMPORT_FIELD_USERNAME
+                        : strcmp(key, "latitude") == 0  ? IMPORT_FIELD_LATITUDE
+                        : strcmp(key, "longitude") == 0 ? IMPORT_FIELD_LONGITUDE
+                        : strcmp(key, "clue") == 0      ? IMPORT_FIELD_CLUE
+                        : strcmp(key, "value") == 0     ? IMPORT_FIELD_VALUE
+                                                        : 0;
+            if (set_import_field(record, field, value, length) != 0)
+            {
+                return "field too long";
+            }
+
+            p = skip_json_space(p);
+            if (*p == ',')
+            {
+                p = skip_json_space(p + 1);
+                continue;
+            }
+            if (*p++ != '}')
+            {
+                return "expected ',' or '}'";
+            }
+            break;
+        }
+    }
+    return *skip_json_space(p) == '\0' ? NULL : "text after the object";
+}
+
+// Function to check an import record and turn it into a treasure whose
+// strings are copied to strings. Returns NULL on success or an error message.
+static const char *validate_import_record(const ImportRecord *record, Treasure *t, char *strings)
+{
+    if (record->fields != IMPORT_FIELDS_ALL)
+    {
+        return "missing fields";
+    }
+    if (record->username[0] == '\0' || strchr(record->username, '\n'))
+    {
+        return "invalid username";
+    }
+
+    char *end;
+    errno = 0;
+    t->latitude = strtod(record->latitude, &end);
+    if (end == record->latitude || *end != '\0' || errno != 0 || t->latitude < -90 || t->latitude > 90)
+    {
+        return "invalid latitude";
+    }
+    t->longitude = strtod(record->longitude, &end);
+    if (end == record->longitude || *end != '\0' || errno != 0 || t->longitude < -180 || t->longitude > 180)
+    {
+        return "invalid longitude";
+    }
+    long value = strtol(record->value, &end, 10);
+    if (end == record->value || *end != '\0' || errno != 0 || value < INT_MIN || value > INT_MAX)
+    {
+        return "invalid value";
+    }
+    t->value = (int)value;
+
+    size_t username_size = strlen(record->username) + 1;
+    memcpy(strings, record->username, username_size);
+    strcpy(strings + username_size, record->clue);
+    t->username = strings;
+    t->clue = strings + username_size;
+    return NULL;
+}
+
+// Function to append a batch of imported treasures with one write and log
+// it with one record. Returns 0 on success.
+static int flush_import_batch(const char *hunt_id, const char *path, Treasure *batch, int count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    int lock = lock_hunt(hunt_id);
+    int appended = append_treasures(hunt_id, batch, count);
+    close(lock);
+
+    LogEvent event = {LOG_OP_IMPORT, appended != 0, batch[0].id, 0, count, NULL, path};
+    log_operation(hunt_id, &event);
+    if (appended != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to import treasures from a CSV (username,latitude,longitude,
+// clue,value, with an optional header line) or JSON Lines file. The file
+// is read one line at a time, and valid treasures are appended in batches
+// of up to IMPORT_BATCH_MAX; invalid lines are reported and skipped.
+// Returns 0 if every line was imported.
+int import_treasures(const char *hunt_id, const char *path)
+{
+    const char *extension = strrchr(path, '.');
+    int jsonl;
+    if (extension && strcmp(extension, ".csv") == 0)
+    {
+        jsonl = 0;
+    }
+    else if (extension && (strcmp(extension, ".jsonl") == 0 || strcmp(extension, ".ndjson") == 0))
+    {
+        jsonl = 1;
+    }
+    else
+    {
+        printf("Unknown import format: %s (use a .csv or .jsonl file)\n", path);
+        return -1;
+    }
+
+    FILE *input = fopen(path, "r");
+    if (!input)
+    {
+        perror("Error opening import file");
+        return -1;
+    }
+    create_hunt_directory(hunt_id);
+
+    Treasure *batch = malloc(IMPORT_BATCH_MAX * sizeof(Treasure));
+    char *strings = malloc(IMPORT_STRINGS_SIZE);
+    ImportRecord *record = malloc(sizeof(ImportRecord));
+    if (!batch || !strings || !record)
+    {
+        perror("Error allocating import buffers");
+        free(batch);
+        free(strings);
+        free(record);
+        fclose(input);
+        return -1;
+    }
+
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+    long line_number = 0, imported = 0, rejected = 0;
+    int count = 0, failed = 0;
+    size_t strings_used = 0;
+    while (!failed && (line_length = getline(&line, &line_size, input)) != -1)
+    {
+        line_number++;
+        while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r'))
+        {
+            line[--line_length] = '\0';
+        }
+        if (line_length == 0 || (!jsonl && line_number == 1 && strncmp(line, "username,", 9) == 0))
+        {
+            continue;
+        }
+
+        const char *error = jsonl ? parse_jsonl_treasure(line, record) : parse_csv_treasure(line, record);
+        if (!error)
+        {
+            error = validate_import_record(record, &batch[count], strings + strings_used);
+        }
+        if (error)
+        {
+            if (rejected++ < IMPORT_MAX_REPORTED)
+            {
+                fprintf(stderr, "%s:%ld: %s\n", path, line_number, error);
+            }
+            continue;
+        }
+        strings_used += strlen(batch[count].username) + 1 + strlen(batch[count].clue) + 1;
+        count++;
+
+        // Flush while a record of the largest size still fits
+        if (count == IMPORT_BATCH_MAX || IMPORT_STRINGS_SIZE - strings_used < MAX_STRING + MAX_CLUE)
+        {
+            failed = flush_import_batch(hunt_id, path, batch, count) != 0;
+            imported += failed ? 0 : count;
+            count = 0;
+            strings_used = 0;
+        }
+    }
+    if (!failed && ferror(input))
+    {
+        perror("Error reading import file");
+        failed = 1;
+    }
+    if (!failed)
+    {
+        failed = flush_import_batch(hunt_id, path, batch, count) != 0;
+        imported += failed ? 0 : count;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (rejected > IMPORT_MAX_REPORTED)
+    {
+        fprintf(stderr, "%s: %ld more invalid lines not shown\n", path, rejected - IMPORT_MAX_REPORTED);
+    }
+    printf("\nImported %ld treasures into hunt %s in %.3f s (%.0f treasures/s), %ld lines rejected%s\n", imported,
+           hunt_id, seconds, seconds > 0 ? imported / seconds : 0.0, rejected, failed ? ", stopped on an error" : "");
+
+    free(line);
+    free(batch);
+    free(strings);
+    free(record);
+    fclose(input);
+    return failed || rejected ? -1 : 0;
+}
+
+// A mapped treasure file. In monitor mode hunts stay mapped between
+// requests and are shared by the workers; every request still stats the
+// file and reloads it if the inode, size, mtime or ctime changed, so
+// appends, removes and compaction by other processes are always seen.
+typedef struct CachedHunt
+{
+    char hunt_id[MAX_STRING];
+    struct stat st;    // Identity of the file when it was mapped
+    TreasureView view;
+    uint64_t *offsets; // Record offset of ID i + 1 (0 = none), only for cached hunts
+    uint32_t offset_count;
+    HuntCoordinates coords; // Built by the first "nearest" query
+    int coords_ready;
+    pthread_mutex_t coords_lock;
+    int refs;          // Requests using the entry, plus one while it is cached
+    unsigned long last_used;
+    struct CachedHunt *next;
+} CachedHunt;
+
+static int hunt_cache_enabled = 0; // Set in monitor mode
+static CachedHunt *hunt_cache = NULL;
+static int hunt_cache_count = 0;
+static unsigned long hunt_cache_clock = 0;
+static pthread_mutex_t hunt_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function to check whether two stats describe the same version of a file
+int same_file_version(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+           a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+// Function to free a hunt nobody uses any more
+void free_cached_hunt(CachedHunt *hunt)
+{
+    treasure_view_close(&hunt->view);
+    free(hunt->offsets);
+    hunt_coordinates_free(&hunt->coords);
+    pthread_mutex_destroy(&hunt->coords_lock);
+    free(hunt);
+}
+
+// Function to map a hunt's treasure file. Hunts that will be cached also
+// get an ID -> offset table, so views don't need the index file.
+CachedHunt *load_cached_hunt(const char *hunt_id, const struct stat *st)
+{
+    CachedHunt *hunt = calloc(1, sizeof(CachedHunt));
+    if (!hunt)
+    {
+        return NULL;
+    }
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &hunt->view) != 0)
+    {
+        free(hunt);
+        return NULL;
+    }
+    snprintf(hunt->hunt_id, sizeof(hunt->hunt_id), "%s", hunt_id);
+    hunt->st = *st; // Taken before mapping, so a change in between only causes an extra reload
+    hunt->refs = 1;
+    pthread_mutex_init(&hunt->coords_lock, NULL);
+
+    if (hunt_cache_enabled && !hunt->view.legacy)
+    {
+        TreasureCursor cursor;
+        Treasure t;
+        treasure_cursor_init(&hunt->view, &cursor);
+        while (treasure_view_next(&hunt->view, &cursor, &t))
+        {
+            if (t.id > 0 && (uint32_t)t.id > hunt->offset_count)
+            {
+                hunt->offset_count = (uint32_t)t.id;
+            }
+        }
+        hunt->offsets = calloc(hunt->offset_count ? hunt->offset_count : 1, sizeof(uint64_t));
+        if (hunt->offsets)
+        {
+            treasure_cursor_init(&hunt->view, &cursor);
+            while (treasure_view_next(&hunt->view, &cursor, &t))
+            {
+                if (t.id > 0)
+                {
+                    hunt->offsets[t.id - 1] = cursor.record_offset;
+                }
+            }
+        }
+    }
+    return hunt;
+}
+
+// Function to take a hunt out of the cache. Called with hunt_cache_lock held.
+void uncache_hunt(CachedHunt *hunt)
+{
+    CachedHunt **link = &hunt_cache;
+    while (*link != hunt)
+    {
+        link = &(*link)->next;
+    }
+    *link = hunt->next;
+    hunt_cache_count--;
+    if (--hunt->refs == 0)
+    {
+        free_cached_hunt(hunt);
+    }
+}
+
+// Function to get the current contents of a hunt, from the cache when it
+// is still valid. Returns NULL if the hunt has no treasure file. The caller
+// must release_hunt() the result.
+CachedHunt *acquire_hunt(const char *hunt_id)
+{
+    struct stat st;
+    int exists = stat(get_treasure_file_path(hunt_id), &st) == 0;
+    if (!hunt_cache_enabled)
+    {
+        return exists ? load_cached_hunt(hunt_id, &st) : NULL;
+    }
+
+    pthread_mutex_lock(&hunt_cache_lock);
+    CachedHunt *cached = hunt_cache;
+    while (cached && strcmp(cached->hunt_id, hunt_id) != 0)
+    {
+        cached = cached->next;
+    }
+    if (cached && exists && same_file_version(&cached->st, &st))
+    {
+        cached->refs++;
+        cached->last_used = ++hunt_cache_clock;
+        pthread_mutex_unlock(&hunt_cache_lock);
+        return cached;
+    }
+    if (cached)
+    {
+        uncache_hunt(cached);
+    }
+    pthread_mutex_unlock(&hunt_cache_lock);
+
+    if (!exists)
+    {
+        return NULL;
+    }
+
+    // Loading happens outside the lock so other hunts are served meanwhile
+    CachedHunt *hunt = load_cached_hunt(hunt_id, &st);
+    if (!hunt)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&hunt_cache_lock);
+    for (cached = hunt_cache; cached; cached = cached->next)
+    {
+        if (strcmp(cached->hunt_id, hunt_id) == 0)
+        {
+            uncache_hunt(cached); // Loaded concurrently by another request
+            break;
+        }
+    }
+    if (hunt_cache_count == HUNT_CACHE_MAX)
+    {
+        CachedHunt *oldest = hunt_cache;
+        for (cached = hunt_cache; cached; cached = cached->next)
+        {
+            if (cached->last_used < oldest->last_used)
+            {
+                oldest = cached;
+            }
+        }
+        uncache_hunt(oldest);
+    }
+    hunt->refs++;
+    hunt->last_used = ++hunt_cache_clock;
+    hunt->next = hunt_cache;
+    hunt_cache = hunt;
+    hunt_cache_count++;
+    pthread_mutex_unlock(&hunt_cache_lock);
+    return hunt;
+}
+
+// Function to release a hunt returned by acquire_hunt()
+void release_hunt(CachedHunt *hunt)
+{
+    if (!hunt)
+    {
+        return;
+    }
+    pthread_mutex_lock(&hunt_cache_lock);
+    int unused = --hunt->refs == 0;
+    pthread_mutex_unlock(&hunt_cache_lock);
+    if (unused)
+    {
+        free_cached_hunt(hunt);
+    }
+}
+
+// Function to find a live treasure in an acquired hunt
+int find_hunt_treasure(CachedHunt *hunt, int treasure_id, Treasure *t, uint64_t *offset)
+{
+    if (!hunt->offsets)
+    {
+        return find_treasure(&hunt->view, hunt->hunt_id, treasure_id, t, offset);
+    }
+    if (treasure_id < 1 || (uint32_t)treasure_id > hunt->offset_count || hunt->offsets[treasure_id - 1] == 0)
+    {
+        return 0;
+    }
+    // The flags are read from the shared mapping, so a remove is seen at once
+    *offset = hunt->offsets[treasure_id - 1];
+    return treasure_view_get(&hunt->view, *offset, t) && t->id == treasure_id;
+}
+
+// Function to list all treasures from a hunt
+void list_treasures(const char *hunt_id, FILE *out)
+{
+    // Clean hunt_id by removing spaces
+    char clean_hunt_id[MAX_STRING];
+    int j = 0;
+    for (int i = 0; hunt_id[i] != '\0'; i++)
+    {
+        if (!isspace(hunt_id[i]))
+        {
+            clean_hunt_id[j++] = hunt_id[i];
+        }
+    }
+    clean_hunt_id[j] = '\0';
+
+    // printf("Debug: Attempting to list treasures for hunt: %s\n", clean_hunt_id);
+
+    CachedHunt *hunt = acquire_hunt(clean_hunt_id);
+    if (!hunt)
+    {
+        // printf("Debug: Failed to open treasure file. Error: %s\n", strerror(errno));
+        fprintf(out, "No treasures found in hunt: %s\n", clean_hunt_id);
+        return;
+    }
+    const TreasureView *view = &hunt->view;
+
+    // printf("Debug: Found %d treasures\n", view->record_count);
+
+    if (view->live_count == 0)
+    {
+        fprintf(out, "No treasures found in hunt: %s\n", clean_hunt_id);
+        LogEvent event = {LOG_OP_LIST, 0, 0, 0, 0, NULL, NULL};
+        log_access(clean_hunt_id, &event);
+        release_hunt(hunt);
+        return;
+    }
+
+    fprintf(out, "Hunt: %s\n", clean_hunt_id);
+    fprintf(out, "File size: %ld bytes\n", hunt->st.st_size);
+    char modified[26];
+    fprintf(out, "Last modified: %s", ctime_r(&hunt->st.st_mtime, modified));
+    fprintf(out, "\nTreasures:\n");
+
+    // Records are printed straight from the mapping
+    TreasureCursor cursor;
+    Treasure treasure;
+    Treasure *t = &treasure;
+    int listed = 0;
+    treasure_cursor_init(view, &cursor);
+    while (treasure_view_next(view, &cursor, t))
+    {
+        listed++;
+        fprintf(out, "\nID: %d\n", t->id);
+        fprintf(out, "Username: %s\n", t->username);
+        fprintf(out, "Location: %.4f, %.4f\n", t->latitude, t->longitude);
+        fprintf(out, "Clue: %s\n", t->clue);
+        fprintf(out, "Value: %d\n", t->value);
+    }
+
+    LogEvent event = {LOG_OP_LIST, 0, 0, 0, listed, NULL, NULL};
+    log_access(clean_hunt_id, &event);
+    release_hunt(hunt);
+}
+
+// Function to find a live treasure by ID in a mapped hunt. Uses treasures.idx
+// for a single index read plus the record's own page, and falls back to a
+// scan when the index is missing or stale. Returns 1 and the record's file
+// offset if found.
+int find_treasure(const TreasureView *view, const char *hunt_id, int treasure_id, Treasure *t, uint64_t *offset)
+{
+    int indexed = treasure_index_lookup(get_index_file_path(hunt_id), view, treasure_id, offset);
+    if (indexed == 0)
+    {
+        return 0;
+    }
+    if (indexed == 1 && treasure_view_get(view, *offset, t) && t->id == treasure_id)
+    {
+        return 1;
+    }
+
+    TreasureCursor cursor;
+    treasure_cursor_init(view, &cursor);
+    while (treasure_view_next(view, &cursor, t))
+    {
+        if (t->id == treasure_id)
+        {
+            *offset = cursor.record_offset;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to view a specific treasure
+void view_treasure(const char *hunt_id, int treasure_id, FILE *out)
+{
+    CachedHunt *hunt = acquire_hunt(hunt_id);
+    if (hunt && !hunt_cache_enabled && hunt->view.data)
+    {
+        // Only one record is needed, don't read ahead around it
+        madvise((void *)hunt->view.data, hunt->view.size, MADV_RANDOM);
+    }
+
+    Treasure treasure;
+    uint64_t offset;
+    if (hunt && find_hunt_treasure(hunt, treasure_id, &treasure, &offset))
+    {
+        Treasure *t = &treasure;
+        fprintf(out, "\nTreasure Details:\n");
+        fprintf(out, "ID: %d\n", t->id);
+        fprintf(out, "Username: %s\n", t->username);
+        fprintf(out, "Location: %.6f, %.6f\n", t->latitude, t->longitude);
+        fprintf(out, "Clue: %s\n", t->clue);
+        fprintf(out, "Value: %d\n", t->value);
+
+        LogEvent event = {LOG_OP_VIEW, 0, t->id, t->value, 0, t->username, NULL};
+        log_access(hunt_id, &event);
+        release_hunt(hunt);
+        return;
+    }
+
+    fprintf(out, "Treasure with ID %d not found in hunt %s\n", treasure_id, hunt_id);
+    LogEvent event = {LOG_OP_VIEW, 1, treasure_id, 0, 0, NULL, "Not found"};
+    log_access(hunt_id, &event);
+    release_hunt(hunt);
+}
+
+// Function to take the writer lock of a hunt. Adds, removes and compaction
+// of the same hunt are serialized on it. Reads (list, view, queries) map
+// the treasure file without it. The exceptions are reads that find a
+// derived file missing or stale: near, bbox and search rebuilding
+// spatial.idx or clues.idx, and the monitor's score command saving a
+// recomputed scores.dat. They take the lock for that one write, so even
+// with access logging off, a read writes to disk in that case. verify
+// takes it to read a consistent hunt.
+// Returns the descriptor to close() to release the lock, or -1.
+int lock_hunt(const char *hunt_id)
+{
+    char dir_path[MAX_STRING];
+    snprintf(dir_path, sizeof(dir_path), "hunt/hunt%s", hunt_id);
+
+    int lock = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if (lock != -1 && flock(lock, LOCK_EX) != 0)
+    {
+        perror("Error locking hunt");
+    }
+    return lock;
+}
+
+// Function to mark the record at offset deleted and drop it from the index.
+// Returns the number of live treasures left, or -1 on error.
+int mark_treasure_deleted(const char *hunt_id, int treasure_id, uint64_t offset, const TreasureView *view)
+{
+    int file = open(get_treasure_file_path(hunt_id), O_RDWR);
+    if (file == -1)
+    {
+        perror("Error opening treasure file");
+        return -1;
+    }
+
+    uint32_t flags;
+    TreasureFileHeader header;
+    off_t flags_offset = (off_t)offset + TREASURE_RECORD_FLAGS_OFFSET;
+    if (pread(file, &flags, sizeof(flags), flags_offset) != (ssize_t)sizeof(flags) ||
+        pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        perror("Error reading treasure record");
+        close(file);
+        return -1;
+    }
+
+    flags |= TREASURE_FLAG_DELETED;
+    header.live_count--;
+    if (pwrite(file, &flags, sizeof(flags), flags_offset) != (ssize_t)sizeof(flags) ||
+        pwrite(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        perror("Error writing tombstone");
+        close(file);
+        return -1;
+    }
+    durable_commit(file);
+    close(file);
+
+    // Clear the index entry if the index belongs to this data file
+    uint64_t indexed_offset;
+    if (treasure_index_lookup(get_index_file_path(hunt_id), view, treasure_id, &indexed_offset) == 1)
+    {
+        int index = open(get_index_file_path(hunt_id), O_WRONLY);
+        uint64_t none = 0;
+        off_t entry_offset = (off_t)(sizeof(TreasureIndexHeader) + (size_t)(treasure_id - 1) * sizeof(none));
+        if (index == -1 || pwrite(index, &none, sizeof(none), entry_offset) != (ssize_t)sizeof(none))
+        {
+            perror("Error updating treasure index");
+        }
+        if (index != -1)
+        {
+            close(index);
+        }
+    }
+
+    return (int)header.live_count;
+}
+
+// Function to remove a treasure. The record is only marked deleted in place,
+// so the other IDs never change and the cost does not depend on the hunt
+// size; "compact" reclaims the space later.
+void remove_treasure(const char *hunt_id, int treasure_id)
+{
+    char *file_path = get_treasure_file_path(hunt_id);
+    int lock = lock_hunt(hunt_id);
+
+    TreasureView view;
+    if (treasure_view_open(file_path, &view) != 0 || view.live_count == 0)
+    {
+        treasure_view_close(&view);
+        close(lock);
+        printf("\nNo treasures to remove in hunt %s\n", hunt_id);
+        LogEvent event = {LOG_OP_REMOVE, 1, 0, 0, 0, NULL, "No treasures found"};
+        log_operation(hunt_id, &event);
+        return;
+    }
+
+    // Tombstones need the current format, so convert older files once
+    if (view.legacy || view.version != TREASURE_FORMAT_VERSION)
+    {
+        treasure_view_close(&view);
+        Hunt *migrated = load_treasures(hunt_id);
+        hunt_free(migrated);
+        if (!migrated || treasure_view_open(file_path, &view) != 0)
+        {
+            close(lock);
+            printf("\nFailed to remove treasure ID %d from hunt %s\n", treasure_id, hunt_id);
+            return;
+        }
+    }
+
+    Treasure existing;
+    uint64_t offset;
+    if (!find_treasure(&view, hunt_id, treasure_id, &existing, &offset))
+    {
+        treasure_view_close(&view);
+        close(lock);
+        printf("\nTreasure ID %d not found in hunt %s\n", treasure_id, hunt_id);
+        LogEvent event = {LOG_OP_REMOVE, 1, treasure_id, 0, 0, NULL, "Not found"};
+        log_operation(hunt_id, &event);
+        return;
+    }
+
+    int remaining = mark_treasure_deleted(hunt_id, treasure_id, offset, &view);
+    if (remaining < 0)
+    {
+        treasure_view_close(&view);
+        close(lock);
+        printf("\nFailed to remove treasure ID %d from hunt %s\n", treasure_id, hunt_id);
+        return;
+    }
+
+    // existing points into the view, so the scores are updated before it is unmapped
+    ScoreSource before, after;
+    score_source_of_view(&view, &before);
+    after = before;
+    after.live_count = (uint32_t)remaining;
+    update_scores(hunt_id, &before, &after, &existing, 1, -1);
+    treasure_view_close(&view);
+    close(lock);
+
+    update_catalog(hunt_id, remaining, -(long long)existing.value);
+
+    LogEvent event = {LOG_OP_REMOVE, 0, treasure_id, existing.value, remaining, NULL, NULL};
+    log_operation(hunt_id, &event);
+
+    printf("\nTreasure ID %d removed successfully.\n", treasure_id);
+}
+
+// Function to rewrite a hunt without its deleted records. IDs are kept as they are.
+// Returns 0 on success, -1 if the hunt is left untouched because it cannot be read.
+int compact_hunt(const char *hunt_id)
+{
+    char *file_path = get_treasure_file_path(hunt_id);
+    struct stat before, after;
+    if (stat(file_path, &before) != 0)
+    {
+        printf("\nNo treasures to compact in hunt %s\n", hunt_id);
+        return 0;
+    }
+
+    int lock = lock_hunt(hunt_id);
+    Hunt *hunt = load_treasures(hunt_id);
+    if (!hunt)
+    {
+        close(lock);
+        printf("\nFailed to compact hunt %s: the treasure file could not be read\n", hunt_id);
+        return -1;
+    }
+    if (save_treasures(hunt_id, hunt) != 0)
+    {
+        close(lock);
+        printf("\nFailed to compact hunt %s: the treasure file could not be rewritten\n", hunt_id);
+        hunt_free(hunt);
+        return -1;
+    }
+    rebuild_scores(hunt_id);
+    rebuild_spatial_index(hunt_id);
+    rebuild_clue_index(hunt_id);
+    close(lock);
+    update_catalog(hunt_id, hunt->treasure_count, 0);
+
+    long reclaimed = 0;
+    if (stat(file_path, &after) == 0)
+    {
+        reclaimed = (long)(before.st_size - after.st_size);
+    }
+
+    LogEvent event = {LOG_OP_COMPACT, 0, 0, hunt->treasure_count, reclaimed, NULL, NULL};
+    log_operation(hunt_id, &event);
+
+    printf("\nHunt %s compacted: %d treasures kept, %ld bytes reclaimed.\n", hunt_id, hunt->treasure_count, reclaimed);
+    hunt_free(hunt);
+    return 0;
+}
+
+// Function to recompute a hunt's scores from the treasure file and compare
+// them with scores.dat. Returns the number of differences, or -1 if the
+// hunt cannot be read.
+int verify_scores(const char *hunt_id)
+{
+    int lock = lock_hunt(hunt_id);
+    TreasureView view;
+    HuntScores actual;
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &view) != 0)
+    {
+        if (lock != -1)
+        {
+            close(lock);
+        }
+        printf("\nNo treasures found in hunt %s\n", hunt_id);
+        return -1;
+    }
+    if (hunt_scores_compute(&view, &actual) != 0)
+    {
+        perror("Error computing scores");
+        treasure_view_close(&view);
+        if (lock != -1)
+        {
+            close(lock);
+        }
+        return -1;
+    }
+
+    ScoreFile file;
+    int differences = 0;
+    if (score_file_read(get_scores_file_path(hunt_id), &file) != 0)
+    {
+        printf("\nScore table of hunt %s is missing or damaged\n", hunt_id);
+        differences = actual.user_count > 0 ? actual.user_count : 1;
+    }
+    else
+    {
+        if (!score_file_matches(&file.header, &view))
+        {
+            printf("Stale: the table describes %u treasures in %llu bytes, the hunt has %d in %llu\n",
+                   file.header.source_live_count, (unsigned long long)file.header.source_end, view.live_count,
+                   (unsigned long long)view.size);
+            differences++;
+        }
+
+        HuntScores *table = &file.scores;
+        uint32_t slot;
+        for (int i = 0; i < actual.user_count; i++)
+        {
+            const UserScore *user = &actual.users[i];
+            int index = hunt_scores_find(table, user->username, user->length, user->hash, &slot);
+            if (index == -1)
+            {
+                printf("Missing: %s (score %d, %d treasures)\n", user->username, user->total_score,
+                       user->treasure_count);
+                differences++;
+            }
+            else if (table->users[index].total_score != user->total_score ||
+                     table->users[index].treasure_count != user->treasure_count)
+            {
+                printf("Mismatch: %s has score %d, %d treasures in the table; %d, %d recomputed\n",
+                       user->username, table->users[index].total_score, table->users[index].treasure_count,
+                       user->total_score, user->treasure_count);
+                differences++;
+            }
+        }
+        for (int i = 0; i < table->user_count; i++)
+        {
+            const UserScore *user = &table->users[i];
+            if (hunt_scores_find(&actual, user->username, user->length, user->hash, &slot) == -1)
+            {
+                printf("Extra: %s (score %d, %d treasures)\n", user->username, user->total_score,
+                       user->treasure_count);
+                differences++;
+            }
+        }
+        score_file_free(&file);
+    }
+
+    if (differences == 0)
+    {
+        printf("\nScore table of hunt %s matches (%d users)\n", hunt_id, actual.user_count);
+    }
+    else
+    {
+        printf("\nScore table of hunt %s differs: %d differences\n", hunt_id, differences);
+    }
+
+    hunt_scores_free(&actual);
+    treasure_view_close(&view);
+    if (lock != -1)
+    {
+        close(lock);
+    }
+    return differences;
+}
+
+void remove_hunt(const char *hunt_id)
+{
+    char dir_path[MAX_STRING];
+    if (snprintf(dir_path, sizeof(dir_path), "hunt/hunt%s", hunt_id) >= sizeof(dir_path))
+    {
+        fprintf(stderr, "Directory path truncated for hunt_id: %s\n", hunt_id);
+        return;
+    }
+
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        perror("Failed to open hunt directory");
+        return;
+    }
+    close_hunt_log(hunt_id); // Records still buffered reach hunt_log.txt first
+
+    struct dirent *entry;
+    char file_path[MAX_STRING];
+
+    // Remove all files in the hunt directory
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        if (snprintf(file_path, sizeof(file_path), "%s/%s", dir_path, entry->d_name) >= sizeof(file_path))
+        {
+            fprintf(stderr, "File path truncated: %s\n", entry->d_name);
+            continue;
+        }
+
+        if (remove(file_path) != 0)
+        {
+            perror("Error deleting file");
+        }
+    }
+
+    closedir(dir);
+
+    // Remove the directory itself
+    if (rmdir(dir_path) != 0)
+    {
+        perror("Failed to remove hunt directory");
+        return;
+    }
+    remove_from_catalog(hunt_id);
+
+    // Remove the symlink to the hunt directory
+    char symlink_path[MAX_STRING];
+    if (snprintf(symlink_path, sizeof(symlink_path), "links_log_hunt/logged_hunt-%s", hunt_id) < sizeof(symlink_path))
+    {
+        unlink(symlink_path); // Ignore errors if it doesn't exist
+    }
+
+    printf("\nHunt %s removed successfully.\n", hunt_id);
+}
+
+// A request waiting for a monitor worker
+typedef struct MonitorJob
+{
+    uint32_t request_id;
+    char *command;
+    struct MonitorJob *next;
+} MonitorJob;
+
+// Requests are queued by the thread reading the request pipe and handled by
+// MONITOR_WORKERS threads. Monitor commands only read hunt files, so any
+// number of them can run at once; their responses are told apart by request
+// ID, and a slow listing no longer holds up the requests behind it.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    MonitorJob *head;
+    MonitorJob *tail;
+    int closing;                   // No more jobs will be queued
+    int response_fd;
+    pthread_mutex_t response_lock; // Frames are written to the pipe one at a time
+} MonitorQueue;
+
+static MonitorQueue monitor_queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, -1,
+                                     PTHREAD_MUTEX_INITIALIZER};
+
+// Function to send one frame to the hub. Data frames can be larger than
+// PIPE_BUF, so workers take turns instead of relying on atomic pipe writes.
+int send_frame(uint32_t request_id, uint16_t type, uint16_t status, const void *payload, size_t length)
+{
+    pthread_mutex_lock(&monitor_queue.response_lock);
+    int result = frame_write(monitor_queue.response_fd, request_id, type, status, payload, length);
+    pthread_mutex_unlock(&monitor_queue.response_lock);
+    return result;
+}
+
+// Function to send a FRAME_END with a message
+void send_end(uint32_t request_id, uint16_t status, const char *message)
+{
+    if (send_frame(request_id, FRAME_END, status, message, message ? strlen(message) : 0) != 0)
+    {
+        perror("Error writing response");
+    }
+}
+
+static ssize_t frame_stream_write(void *cookie, const char *buf, size_t size)
+{
+    uint32_t request_id = *(uint32_t *)cookie;
+    size_t sent = 0;
+    while (sent < size)
+    {
+        size_t chunk = size - sent < FRAME_DATA_CHUNK ? size - sent : FRAME_DATA_CHUNK;
+        if (send_frame(request_id, FRAME_DATA, STATUS_OK, buf + sent, chunk) != 0)
+        {
+            return sent > 0 ? (ssize_t)sent : -1;
+        }
+        sent += chunk;
+    }
+    return (ssize_t)size;
+}
+
+static int frame_stream_close(void *cookie)
+{
+    free(cookie);
+    return 0;
+}
+
+// Function to open the output stream of a response. Everything written to
+// it is sent to the hub as FRAME_DATA frames of request_id, in
+// FRAME_DATA_CHUNK sized pieces.
+FILE *open_frame_stream(uint32_t request_id)
+{
+    uint32_t *cookie = malloc(sizeof(uint32_t));
+    if (!cookie)
+    {
+        return NULL;
+    }
+    *cookie = request_id;
+
+    cookie_io_functions_t io = {NULL, frame_stream_write, NULL, frame_stream_close};
+    FILE *file = fopencookie(cookie, "w", io);
+    if (!file)
+    {
+        free(cookie);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, FRAME_DATA_CHUNK);
+    return file;
+}
+
+// Function to list all hunts with their number of treasures, from the catalog
+void list_hunts(FILE *out)
+{
+    CatalogEntry *entries;
+    int count = read_catalog(&entries);
+    if (count < 0)
+    {
+        fprintf(out, "Error: Could not open hunt directory\n");
+        return;
+    }
+    if (count == 0)
+    {
+        fprintf(out, "No hunts found\n");
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        char modified[26] = "never\n";
+        if (entries[i].modified != 0)
+        {
+            ctime_r(&entries[i].modified, modified);
+        }
+        fprintf(out, "Hunt %s: %d treasures, total value %lld, last modified %s", entries[i].hunt_id,
+                entries[i].live_count, entries[i].total_value, modified);
+    }
+    free(entries);
+}
+
+// Output of an export. Short pieces are copied into buf; long strings that
+// need no escaping are referenced straight from the mapped treasure file.
+// Both are queued as iovecs and written with writev once buf or the iovec
+// array fills up, so memory use does not depend on the hunt size.
+typedef struct
+{
+    int fd;
+    char *buf;
+    size_t used;         // Bytes of buf in use
+    size_t queued;       // Bytes of buf already covered by iov
+    struct iovec iov[EXPORT_IOV_MAX];
+    int iovcnt;
+    const char *header; // Written before the first hunt that can be read
+    int failed;
+} ExportWriter;
+
+// Function to write everything queued and start over with an empty buffer
+static void export_flush(ExportWriter *w)
+{
+    if (w->used > w->queued)
+    {
+        w->iov[w->iovcnt].iov_base = w->buf + w->queued;
+        w->iov[w->iovcnt].iov_len = w->used - w->queued;
+        w->iovcnt++;
+    }
+
+    struct iovec *next = w->iov;
+    int iovcnt = w->iovcnt;
+    while (iovcnt > 0 && !w->failed)
+    {
+        ssize_t written = writev(w->fd, next, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error writing export");
+            w->failed = 1;
+            break;
+        }
+        while (iovcnt > 0 && (size_t)written >= next->iov_len)
+        {
+            written -= next->iov_len;
+            next++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            next->iov_base = (char *)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+    w->used = 0;
+    w->queued = 0;
+    w->iovcnt = 0;
+}
+
+// Function to make room for length more bytes in the buffer
+static char *export_reserve(ExportWriter *w, size_t length)
+{
+    if (EXPORT_BUFFER_SIZE - w->used < length || w->iovcnt >= EXPORT_IOV_MAX - 1)
+    {
+        export_flush(w);
+    }
+    return w->buf + w->used;
+}
+
+static void export_copy(ExportWriter *w, const char *data, size_t length)
+{
+    memcpy(export_reserve(w, length), data, length);
+    w->used += length;
+}
+
+// Function to output data that stays valid until the next flush without
+// copying it, unless it is short enough that copying is cheaper
+static void export_reference(ExportWriter *w, const char *data, size_t length)
+{
+    if (length < EXPORT_COPY_MAX)
+    {
+        export_copy(w, data, length);
+        return;
+    }
+    if (w->iovcnt >= EXPORT_IOV_MAX - 2)
+    {
+        export_flush(w);
+    }
+    if (w->used > w->queued)
+    {
+        w->iov[w->iovcnt].iov_base = w->buf + w->queued;
+        w->iov[w->iovcnt].iov_len = w->used - w->queued;
+        w->iovcnt++;
+        w->queued = w->used;
+    }
+    w->iov[w->iovcnt].iov_base = (void *)data;
+    w->iov[w->iovcnt].iov_len = length;
+    w->iovcnt++;
+}
+
+// Function to output a literal string
+static void export_text(ExportWriter *w, const char *text)
+{
+    export_copy(w, text, strlen(text));
+}
+
+// Function to output an integer. Numbers are formatted by hand because
+// printf is the bulk of the export time otherwise.
+static void export_int(ExportWriter *w, long long value)
+{
+    char digits[24];
+    int n = 0;
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do
+    {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0)
+    {
+        digits[n++] = '-';
+    }
+
+    char *out = export_reserve(w, (size_t)n);
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = digits[n - 1 - i];
+    }
+    w->used += (size_t)n;
+}
+
+// Function to output a coordinate with six decimals, like "%.6f"
+static void export_coordinate(ExportWriter *w, double x)
+{
+    double magnitude = x < 0 ? -x : x;
+    if (!(magnitude < 1e12))
+    {
+        // NaN or too large for the integer path
+        char *out = export_reserve(w, 64);
+        w->used += (size_t)snprintf(out, 64, "%.6f", x);
+        return;
+    }
+
+    long long scaled = (long long)(magnitude * 1e6 + 0.5);
+    if (x < 0)
+    {
+        export_copy(w, "-", 1);
+    }
+    export_int(w, scaled / 1000000);
+    char *out = export_reserve(w, 7);
+    long long fraction = scaled % 1000000;
+    out[0] = '.';
+    for (int i = 6; i >= 1; i--)
+    {
+        out[i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    w->used += 7;
+}
+
+// Function to output a CSV field, quoted only when it has to be
+static void export_csv_string(ExportWriter *w, const char *s)
+{
+    size_t length = strlen(s);
+    if (strcspn(s, ",\"\n\r") == length)
+    {
+        export_reference(w, s, length);
+        return;
+    }
+
+    char *out = export_reserve(w, 2 * length + 2);
+    size_t n = 0;
+    out[n++] = '"';
+    for (const char *p = s; *p; p++)
+    {
+        if (*p == '"')
+        {
+            out[n++] = '"';
+        }
+        out[n++] = *p;
+    }
+    out[n++] = '"';
+    w->used += n;
+}
+
+// Function to output a JSON string with its quotes
+static void export_json_string(ExportWriter *w, const char *s)
+{
+    size_t length = strlen(s);
+    size_t plain = 0;
+    while (plain < length && (unsigned char)s[plain] >= 0x20 && s[plain] != '"' && s[plain] != '\\')
+    {
+        plain++;
+    }
+    export_copy(w, "\"", 1);
+    if (plain == length)
+    {
+        export_reference(w, s, length);
+        export_copy(w, "\"", 1);
+        return;
+    }
+
+    char *out = export_reserve(w, 6 * length + 1);
+    size_t n = 0;
+    for (const char *p = s; *p; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\')
+        {
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        }
+        else if (c == '\n')
+        {
+            out[n++] = '\\';
+            out[n++] = 'n';
+        }
+        else if (c < 0x20)
+        {
+            n += (size_t)snprintf(out + n, 7, "\\u%04x", c);
+        }
+        else
+        {
+            out[n++] = (char)c;
+        }
+    }
+    out[n++] = '"';
+    w->used += n;
+}
+
+// Function to stream the live treasures of one hunt to the writer.
+// Returns the number exported, or -1 if the hunt cannot be read.
+static long export_hunt(ExportWriter *w, const char *hunt_id, int jsonl)
+{
+    TreasureView view;
+    if (treasure_view_open(get_treasure_file_path(hunt_id), &view) != 0)
+    {
+        fprintf(stderr, "No treasures found in hunt: %s\n", hunt_id);
+        return -1;
+    }
+    if (view.map_size > 0)
+    {
+        madvise((void *)view.data, view.map_size, MADV_SEQUENTIAL);
+    }
+    if (w->header)
+    {
+        export_text(w, w->header);
+        w->header = NULL;
+    }
+
+    TreasureCursor cursor;
+    Treasure treasure;
+    Treasure *t = &treasure;
+    long exported = 0;
+    treasure_cursor_init(&view, &cursor);
+    while (!w->failed && treasure_view_next(&view, &cursor, t))
+    {
+        exported++;
+        if (jsonl)
+        {
+            export_text(w, "{\"hunt_id\":");
+            export_json_string(w, hunt_id);
+            export_text(w, ",\"id\":");
+            export_int(w, t->id);
+            export_text(w, ",\"username\":");
+            export_json_string(w, t->username);
+            export_text(w, ",\"latitude\":");
+            export_coordinate(w, t->latitude);
+            export_text(w, ",\"longitude\":");
+            export_coordinate(w, t->longitude);
+            export_text(w, ",\"clue\":");
+            export_json_string(w, t->clue);
+            export_text(w, ",\"value\":");
+            export_int(w, t->value);
+            export_text(w, "}\n");
+        }
+        else
+        {
+            export_csv_string(w, hunt_id);
+            export_text(w, ",");
+            export_int(w, t->id);
+            export_text(w, ",");
+            export_csv_string(w, t->username);
+            export_text(w, ",");
+            export_coordinate(w, t->latitude);
+            export_text(w, ",");
+            export_coordinate(w, t->longitude);
+            export_text(w, ",");
+            export_csv_string(w, t->clue);
+            export_text(w, ",");
+            export_int(w, t->value);
+            export_text(w, "\n");
+        }
+    }
+
+    // The queued iovecs may point into the mapping
+    export_flush(w);
+    treasure_view_close(&view);
+    return exported;
+}
+
+// Function to export the live treasures of a hunt, or of every hunt for
+// "--all", to stdout as CSV or JSON Lines. Returns 0 on success.
+int export_treasures(const char *hunt_id, const char *format)
+{
+    int jsonl;
+    if (strcmp(format, "csv") == 0)
+    {
+        jsonl = 0;
+    }
+    else if (strcmp(format, "jsonl") == 0)
+    {
+        jsonl = 1;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown export format: %s (use csv or jsonl)\n", format);
+        return -1;
+    }
+
+    ExportWriter w;
+    memset(&w, 0, sizeof(w));
+    w.fd = STDOUT_FILENO;
+    w.buf = malloc(EXPORT_BUFFER_SIZE);
+    if (!w.buf)
+    {
+        perror("Error allocating export buffer");
+        return -1;
+    }
+    fflush(stdout);
+
+    if (!jsonl)
+    {
+        w.header = "hunt_id,id,username,latitude,longitude,clue,value\n";
+    }
+
+    long exported = 0;
+    int result = 0;
+    if (strcmp(hunt_id, "--all") == 0)
+    {
+        CatalogEntry *entries;
+        int count = read_catalog(&entries);
+        if (count < 0)
+        {
+            fprintf(stderr, "Error: Could not read the hunt catalog\n");
+            result = -1;
+        }
+        for (int i = 0; i < count && !w.failed; i++)
+        {
+            long hunt_exported = export_hunt(&w, entries[i].hunt_id, jsonl);
+            exported += hunt_exported > 0 ? hunt_exported : 0;
+        }
+        if (count >= 0)
+        {
+            free(entries);
+        }
+    }
+    else
+    {
+        exported = export_hunt(&w, hunt_id, jsonl);
+        result = exported < 0 ? -1 : 0;
+    }
+    export_flush(&w);
+    free(w.buf);
+
+    fprintf(stderr, "Exported %ld treasures\n", exported > 0 ? exported : 0);
+    return w.failed ? -1 : result;
+}
+
+// A treasure found by a spatial query
+typedef struct
+{
+    Treasure treasure;
+    double distance; // Meters from the center of a "near" query
+} SpatialMatch;
+
+// Results of a spatial query; the strings point into the hunt's mapping
+typedef struct
+{
+    SpatialMatch *matches;
+    int count;
+    int capacity;
+    const SpatialBox *box;
+    int near;               // Filter by distance from center, not only by box
+    double center_lat, center_lon, radius_m;
+} SpatialQuery;
+
+// Function to keep t if it matches the query. Returns -1 if memory ran out.
+static int spatial_consider(SpatialQuery *query, const Treasure *t)
+{
+    if (!spatial_box_contains(query->box, t->latitude, t->longitude))
+    {
+        return 0;
+    }
+    double distance = 0;
+    if (query->near)
+    {
+        distance = spatial_distance_m(query->center_lat, query->center_lon, t->latitude, t->longitude);
+        if (distance > query->radius_m)
+        {
+            return 0;
+        }
+    }
+
+    if (query->count == query->capacity)
+    {
+        int capacity = query->capacity ? query->capacity * 2 : 64;
+        SpatialMatch *grown = realloc(query->matches, (size_t)capacity * sizeof(SpatialMatch));
+        if (!grown)
+        {
+            return -1;
+        }
+        query->matches = grown;
+        query->capacity = capacity;
+    }
+    query->matches[query->count].treasure = *t;
+    query->matches[query->count].distance = distance;
+    query->count++;
+    return 0;
+}
+
+// Function to look up the entries of one box that does not cross the
+// antimeridian: binary search each run for each covering key range, skip
+// entries whose quantized position is outside the box, and check the rest
+// against the records themselves (which also drops removed treasures).
+static int spatial_search_box(SpatialQuery *query, const SpatialIndex *index, const TreasureView *view,
+                              double min_lon, double max_lon)
+{
+    uint32_t qlat0 = spatial_quantize(query->box->min_lat, -90, 90);
+    uint32_t qlat1 = spatial_quantize(query->box->max_lat, -90, 90);
+    uint32_t qlon0 = spatial_quantize(min_lon, -180, 180);
+    uint32_t qlon1 = spatial_quantize(max_lon, -180, 180);
+    uint64_t ranges[2 * SPATIAL_COVER_CELLS * SPATIAL_COVER_CELLS];
+    int range_count = spatial_cover(qlat0, qlat1, qlon0, qlon1, ranges);
+
+    for (uint32_t r = 0; r < index->header.run_count; r++)
+    {
+        const SpatialEntry *entries = spatial_run_entries(index, r);
+        uint64_t count = index->header.runs[r].count;
+        for (int c = 0; c < range_count; c++)
+        {
+            uint64_t last = ranges[2 * c + 1];
+            for (uint64_t i = spatial_lower_bound(entries, count, ranges[2 * c]);
+                 i < count && entries[i].key <= last; i++)
+            {
+                uint32_t qlat = spatial_compact(entries[i].key);
+                uint32_t qlon = spatial_compact(entries[i].key >> 1);
+                Treasure t;
+                if (qlat < qlat0 || qlat > qlat1 || qlon < qlon0 || qlon > qlon1 ||
+                    !treasure_view_get(view, entries[i].offset, &t))
+                {
+                    continue;
+                }
+                if (spatial_consider(query, &t) != 0)
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Function to find the treasures of a hunt matching a query with its
+// spatial index, rebuilding the index first if it is missing or stale.
+// Without a usable index every record is checked. Returns 0 on success.
+static int spatial_search(const char *hunt_id, const TreasureView *view, SpatialQuery *query)
+{
+    SpatialIndex index;
+    int indexed = !view->legacy && spatial_index_open(get_spatial_file_path(hunt_id), SPATIAL_MAGIC, view, &index) == 0;
+    if (!indexed && !view->legacy)
+    {
+        int lock = lock_hunt(hunt_id);
+        rebuild_spatial_index(hunt_id);
+        if (lock != -1)
+        {
+            close(lock);
+        }
+        indexed = spatial_index_open(get_spatial_file_path(hunt_id), SPATIAL_MAGIC, view, &index) == 0;
+    }
+
+    int result = 0;
+    if (indexed)
+    {
+        const SpatialBox *box = query->box;
+        if (box->min_lon <= box->max_lon)
+        {
+            result = spatial_search_box(query, &index, view, box->min_lon, box->max_lon);
+        }
+        else
+        {
+            result = spatial_search_box(query, &index, view, box->min_lon, 180);
+            if (result == 0)
+            {
+                result = spatial_search_box(query, &index, view, -180, box->max_lon);
+            }
+        }
+        spatial_index_close(&index);
+        return result;
+    }
+
+    // The hunt changed while the index was rebuilt, or cannot be indexed
+    TreasureCursor cursor;
+    Treasure t;
+    treasure_cursor_init(view, &cursor);
+    while (result == 0 && treasure_view_next(view, &cursor, &t))
+    {
+        result = spatial_consider(query, &t);
+    }
+    return result;
+}
+
+static int compare_matches_by_distance(const void *a, const void *b)
+{
+    const SpatialMatch *x = a, *y = b;
+    if (x->distance != y->distance)
+    {
+        return x->distance < y->distance ? -1 : 1;
+    }
+    return x->treasure.id - y->treasure.id;
+}
+
+static int compare_matches_by_id(const void *a, const void *b)
+{
+    const SpatialMatch *x = a, *y = b;
+    return x->treasure.id - y->treasure.id;
+}
+
+// Function to run a spatial query on a hunt and print the matches, nearest
+// first for "near" queries and by ID for boxes. Returns a STATUS_ code.
+int print_spatial_query(const char *hunt_id, SpatialQuery *query, FILE *out)
+{
+    CachedHunt *hunt = acquire_hunt(hunt_id);
+    if (!hunt)
+    {
+        fprintf(out, "No treasures found in hunt: %s\n", hunt_id);
+        return STATUS_ERROR;
+    }
+
+    if (spatial_search(hunt_id, &hunt->view, query) != 0)
+    {
+        fprintf(out, "Error: Out of memory\n");
+        free(query->matches);
+        release_hunt(hunt);
+        return STATUS_ERROR;
+    }
+    qsort(query->matches, (size_t)query->count, sizeof(SpatialMatch),
+          query->near ? compare_matches_by_distance : compare_matches_by_id);
+
+    if (query->near)
+    {
+        fprintf(out, "\nFound %d treasures within %.0f m of %.6f, %.6f in hunt %s\n", query->count, query->radius_m,
+                query->center_lat, query->center_lon, hunt_id);
+    }
+    else
+    {
+        fprintf(out, "\nFound %d treasures between %.6f, %.6f and %.6f, %.6f in hunt %s\n", query->count,
+                query->box->min_lat, query->box->min_lon, query->box->max_lat, query->box->max_lon, hunt_id);
+    }
+    for (int i = 0; i < query->count; i++)
+    {
+        const Treasure *t = &query->matches[i].treasure;
+        fprintf(out, "ID: %d | %s | %.6f, %.6f", t->id, t->username, t->latitude, t->longitude);
+        if (query->near)
+        {
+            fprintf(out, " | %.1f m", query->matches[i].distance);
+        }
+        fprintf(out, " | Value: %d | %s\n", t->value, t->clue);
+    }
+
+    free(query->matches);
+    release_hunt(hunt);
+    return STATUS_OK;
+}
+
+// Function to print the treasures within radius_m meters of a point
+int near_treasures(const char *hunt_id, double latitude, double longitude, double radius_m, FILE *out)
+{
+    if (latitude < -90 || latitude > 90 || longitude < -180 || longitude > 180 || !(radius_m >= 0))
+    {
+        fprintf(out, "Invalid location or radius\n");
+        return STATUS_BAD_REQUEST;
+    }
+
+    SpatialBox box;
+    spatial_box_around(latitude, longitude, radius_m, &box);
+    SpatialQuery query = {NULL, 0, 0, &box, 1, latitude, longitude, radius_m};
+    return print_spatial_query(hunt_id, &query, out);
+}
+
+// Function to print the treasures inside a box. A box whose min_lon is
+// greater than its max_lon crosses the antimeridian.
+int bbox_treasures(const char *hunt_id, double min_lat, double min_lon, double max_lat, double max_lon, FILE *out)
+{
+    if (min_lat < -90 || max_lat > 90 || min_lat > max_lat || min_lon < -180 || min_lon > 180 || max_lon < -180 ||
+        max_lon > 180)
+    {
+        fprintf(out, "Invalid box\n");
+        return STATUS_BAD_REQUEST;
+    }
+
+    SpatialBox box = {min_lat, max_lat, min_lon, max_lon};
+    SpatialQuery query = {NULL, 0, 0, &box, 0, 0, 0, 0};
+    return print_spatial_query(hunt_id, &query, out);
+}
+
+// Function to get the coordinates of an acquired hunt, built on first use
+// and kept with the cached hunt. Returns NULL if memory ran out.
+const HuntCoordinates *get_hunt_coordinates(CachedHunt *hunt)
+{
+    pthread_mutex_lock(&hunt->coords_lock);
+    if (!hunt->coords_ready && hunt_coordinates_build(&hunt->view, &hunt->coords) == 0)
+    {
+        hunt->coords_ready = 1;
+    }
+    int ready = hunt->coords_ready;
+    pthread_mutex_unlock(&hunt->coords_lock);
+    return ready ? &hunt->coords : NULL;
+}
+
+// Whether treasure a is farther than treasure b (ties broken by ID)
+static int farther(const double *distances, const int *ids, int a, int b)
+{
+    return distances[a] != distances[b] ? distances[a] > distances[b] : ids[a] > ids[b];
+}
+
+// Function to restore the max-heap of treasure positions below slot i
+static void sift_down(int *heap, int count, int i, const double *distances, const int *ids)
+{
+    while (2 * i + 1 < count)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < count && farther(distances, ids, heap[child + 1], heap[child]))
+        {
+            child++;
+        }
+        if (!farther(distances, ids, heap[child], heap[i]))
+        {
+            break;
+        }
+        int swap = heap[i];
+        heap[i] = heap[child];
+        heap[child] = swap;
+        i = child;
+    }
+}
+
+// Function to print the k treasures nearest to a point. The distances to
+// every treasure are computed in bulk by the fastest kernel of the CPU and
+// the k nearest kept in a max-heap. Returns a STATUS_ code.
+int nearest_treasures(const char *hunt_id, double latitude, double longitude, int k, FILE *out)
+{
+    if (latitude < -90 || latitude > 90 || longitude < -180 || longitude > 180 || k <= 0)
+    {
+        fprintf(out, "Invalid location or count\n");
+        return STATUS_BAD_REQUEST;
+    }
+
+    CachedHunt *hunt = acquire_hunt(hunt_id);
+    if (!hunt)
+    {
+        fprintf(out, "No treasures found in hunt: %s\n", hunt_id);
+        return STATUS_ERROR;
+    }
+    const HuntCoordinates *coords = get_hunt_coordinates(hunt);
+    double *distances = coords ? malloc((coords->count ? coords->count : 1) * sizeof(double)) : NULL;
+    int *heap = distances ? malloc((size_t)k * sizeof(int)) : NULL;
+    if (!heap)
+    {
+        fprintf(out, "Error: Out of memory\n");
+        free(distances);
+        release_hunt(hunt);
+        return STATUS_ERROR;
+    }
+
+    hunt_distances(coords, latitude, longitude, distances);
+    int count = 0;
+    for (size_t i = 0; i < coords->count; i++)
+    {
+        if (count < k)
+        {
+            // Sift the new treasure up
+            int slot = count++;
+            heap[slot] = (int)i;
+            while (slot > 0 && farther(distances, coords->ids, heap[slot], heap[(slot - 1) / 2]))
+            {
+                int parent = (slot - 1) / 2;
+                int swap = heap[slot];
+                heap[slot] = heap[parent];
+                heap[parent] = swap;
+                slot = parent;
+            }
+        }
+        else if (farther(distances, coords->ids, heap[0], (int)i))
+        {
+            heap[0] = (int)i;
+            sift_down(heap, count, 0, distances, coords->ids);
+        }
+    }
+
+    // Pop the farthest to the back, leaving the heap sorted nearest first
+    for (int end = count - 1; end > 0; end--)
+    {
+        int swap = heap[0];
+        heap[0] = heap[end];
+        heap[end] = swap;
+        sift_down(heap, end, 0, distances, coords->ids);
+    }
+
+    fprintf(out, "\nNearest %d treasures to %.6f, %.6f in hunt %s\n", count, latitude, longitude, hunt_id);
+    for (int i = 0; i < count; i++)
+    {
+        Treasure t;
+        if (treasure_view_get(&hunt->view, coords->offsets[heap[i]], &t) != 1)
+        {
+            continue;
+        }
+        fprintf(out, "ID: %d | %s | %.6f, %.6f | %.1f m | Value: %d | %s\n", t.id, t.username, t.latitude,
+                t.longitude, distances[heap[i]], t.value, t.clue);
+    }
+
+    free(heap);
+    free(distances);
+    release_hunt(hunt);
+    return STATUS_OK;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Function to time the distance kernels on a hunt against the naive loop,
+// which calls spatial_distance_m() on each treasure's latitude and
+// longitude. Every kernel runs on the same random points and its largest
+// difference from the naive distances is reported. Returns a STATUS_ code.
+int bench_distance(const char *hunt_id, int queries, FILE *out)
+{
+    if (queries <= 0)
+    {
+        fprintf(out, "Invalid query count\n");
+        return STATUS_BAD_REQUEST;
+    }
+    CachedHunt *hunt = acquire_hunt(hunt_id);
+    if (!hunt)
+    {
+        fprintf(out, "No treasures found in hunt: %s\n", hunt_id);
+        return STATUS_ERROR;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const HuntCoordinates *coords = get_hunt_coordinates(hunt);
+    double build_seconds = seconds_since(&start);
+
+    size_t n = coords && coords->count ? coords->count : 1;
+    double *points = coords ? malloc(2 * n * sizeof(double)) : NULL;
+    double *expected = points ? malloc(n * sizeof(double)) : NULL;
+    double *distances = expected ? malloc(n * sizeof(double)) : NULL;
+    if (!distances)
+    {
+        fprintf(out, "Error: Out of memory\n");
+        free(points);
+        free(expected);
+        release_hunt(hunt);
+        return STATUS_ERROR;
+    }
+    for (size_t i = 0; i < coords->count; i++)
+    {
+        Treasure t;
+        memset(&t, 0, sizeof(t));
+        treasure_view_get(&hunt->view, coords->offsets[i], &t);
+        points[2 * i] = t.latitude;
+        points[2 * i + 1] = t.longitude;
+    }
+
+    const DistanceKernel kernels[] = {DISTANCE_KERNEL_SCALAR, DISTANCE_KERNEL_SSE2, DISTANCE_KERNEL_AVX2};
+    const int kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+    double naive_seconds = 0, kernel_seconds[3] = {0}, max_error[3] = {0};
+    unsigned int seed = 12345;
+    for (int q = 0; q < queries; q++)
+    {
+        double latitude = rand_r(&seed) / (double)RAND_MAX * 180 - 90;
+        double longitude = rand_r(&seed) / (double)RAND_MAX * 360 - 180;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < coords->count; i++)
+        {
+            expected[i] = spatial_distance_m(latitude, longitude, points[2 * i], points[2 * i + 1]);
+        }
+        naive_seconds += seconds_since(&start);
+
+        for (int k = 0; k < kernel_count; k++)
+        {
+            if (!distance_kernel_supported(kernels[k]))
+            {
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            hunt_distances_with(kernels[k], coords, latitude, longitude, distances);
+            kernel_seconds[k] += seconds_since(&start);
+            for (size_t i = 0; i < coords->count; i++)
+            {
+                double error = fabs(distances[i] - expected[i]);
+                max_error[k] = error > max_error[k] ? error : max_error[k];
+            }
+        }
+    }
+
+    double evaluated = (double)coords->count * queries;
+    fprintf(out, "\nDistance benchmark for hunt %s: %zu treasures, %d queries\n", hunt_id, coords->count, queries);
+    fprintf(out, "Coordinate arrays built in %.3f ms\n", build_seconds * 1000);
+    fprintf(out, "%-8s %10s %14s %10s %14s\n", "Kernel", "ns/point", "points/s", "Speedup", "Max error (m)");
+    fprintf(out, "%-8s %10.2f %14.0f %10s %14s\n", "naive", evaluated > 0 ? naive_seconds * 1e9 / evaluated : 0.0,
+            naive_seconds > 0 ? evaluated / naive_seconds : 0.0, "1.00x", "-");
+    for (int k = 0; k < kernel_count; k++)
+    {
+        if (!distance_kernel_supported(kernels[k]))
+        {
+            fprintf(out, "%-8s %10s\n", distance_kernel_name(kernels[k]), "unsupported");
+            continue;
+        }
+        fprintf(out, "%-8s %10.2f %14.0f %9.2fx %14.2g\n", distance_kernel_name(kernels[k]),
+                evaluated > 0 ? kernel_seconds[k] * 1e9 / evaluated : 0.0,
+                kernel_seconds[k] > 0 ? evaluated / kernel_seconds[k] : 0.0,
+                kernel_seconds[k] > 0 ? naive_seconds / kernel_seconds[k] : 0.0, max_error[k]);
+    }
+    fprintf(out, "Queries use %s\n", distance_kernel_name(distance_kernel_best()));
+
+    free(points);
+    free(expected);
+    free(distances);
+    release_hunt(hunt);
+    return STATUS_OK;
+}
+
+// Function to collect the offsets of the live treasures of a hunt whose
+// clues contain every term. Posting lists are intersected from the
+// shortest one, each list skipping ahead to the current candidate, so
+// common words cost little next to rare ones. Without a usable clue index
+// every clue is checked. Returns the number of matches, or -1 on error.
+static long search_hunt(const char *hunt_id, const TreasureView *view, PostingList *terms, int term_count,
+                        uint64_t **matches)
+{
+    long count = 0, capacity = 64;
+    *matches = malloc((size_t)capacity * sizeof(uint64_t));
+    if (!*matches)
+    {
+        return -1;
+    }
+
+    SpatialIndex index;
+    int indexed = !view->legacy && spatial_index_open(get_clue_file_path(hunt_id), CLUE_INDEX_MAGIC, view, &index) == 0;
+    if (!indexed && !view->legacy)
+    {
+        int lock = lock_hunt(hunt_id);
+        rebuild_clue_index(hunt_id);
+        if (lock != -1)
+        {
+            close(lock);
+        }
+        indexed = spatial_index_open(get_clue_file_path(hunt_id), CLUE_INDEX_MAGIC, view, &index) == 0;
+    }
+
+    TreasureCursor cursor;
+    Treasure t;
+    uint64_t offset = 0, target = 0;
+    if (indexed)
+    {
+        for (int i = 0; i < term_count; i++)
+        {
+            posting_list_open(&terms[i], &index);
+        }
+        for (int i = 1; i < term_count; i++)
+        {
+            for (int j = i; j > 0 && terms[j].total < terms[j - 1].total; j--)
+            {
+                PostingList swap = terms[j];
+                terms[j] = terms[j - 1];
+                terms[j - 1] = swap;
+            }
+        }
+    }
+    else
+    {
+        treasure_cursor_init(view, &cursor);
+    }
+
+    while (1)
+    {
+        int candidate;
+        if (indexed)
+        {
+            if (!posting_list_seek(&terms[0], target, &offset))
+            {
+                break;
+            }
+            target = offset + 1;
+            candidate = 1;
+            int exhausted = 0;
+            for (int i = 1; candidate && i < term_count; i++)
+            {
+                uint64_t found;
+                exhausted = !posting_list_seek(&terms[i], offset, &found);
+                if (exhausted || found != offset)
+                {
+                    target = exhausted ? 0 : found;
+                    candidate = 0;
+                }
+            }
+            if (exhausted)
+            {
+                break;
+            }
+            candidate = candidate && treasure_view_get(view, offset, &t) == 1;
+        }
+        else
+        {
+            if (!treasure_view_next(view, &cursor, &t))
+            {
+                break;
+            }
+            offset = cursor.record_offset;
+            candidate = 1;
+        }
+
+        // Confirm the words in the clue itself, which rules out hash collisions
+        for (int i = 0; candidate && i < term_count; i++)
+        {
+            candidate = clue_contains_word(t.clue, terms[i].word, terms[i].length);
+        }
+        if (!candidate)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity *= 2;
+            uint64_t *grown = realloc(*matches, (size_t)capacity * sizeof(uint64_t));
+            if (!grown)
+            {
+                count = -1;
+                break;
+            }
+            *matches = grown;
+        }
+        (*matches)[count++] = offset;
+    }
+
+    if (indexed)
+    {
+        spatial_index_close(&index);
+    }
+    if (count < 0)
+    {
+        free(*matches);
+        *matches = NULL;
+    }
+    return count;
+}
+
+// Function to search one hunt and print its matches in file order (by
+// ID). Hunts without matches print nothing when quiet is set.
+// Returns the number of matches, or -1 on error.
+static long print_search(const char *hunt_id, const char *query, PostingList *terms, int term_count, int quiet,
+                         FILE *out)
+{
+    CachedHunt *hunt = acquire_hunt(hunt_id);
+    if (!hunt)
+    {
+        if (!quiet)
+        {
+            fprintf(out, "No treasures found in hunt: %s\n", hunt_id);
+        }
+        return -1;
+    }
+
+    uint64_t *matches;
+    long count = search_hunt(hunt_id, &hunt->view, terms, term_count, &matches);
+    if (count < 0)
+    {
+        fprintf(out, "Error: Out of memory\n");
+        release_hunt(hunt);
+        return -1;
+    }
+    if (count > 0 || !quiet)
+    {
+        fprintf(out, "\nFound %ld treasures matching \"%s\" in hunt %s\n", count, query, hunt_id);
+    }
+    for (long i = 0; i < count; i++)
+    {
+        Treasure t;
+        if (treasure_view_get(&hunt->view, matches[i], &t) != 1)
+        {
+            continue;
+        }
+        fprintf(out, "ID: %d | %s | %.6f, %.6f | Value: %d | %s\n", t.id, t.username, t.latitude, t.longitude,
+                t.value, t.clue);
     }
 
-    log_operation(hunt_id, "ADD", log_details);
-    printf("\nTreasure added successfully with ID: %d\n", new_treasure->id);
+    free(matches);
+    release_hunt(hunt);
+    return count;
 }
 
-// Function to list all treasures from a hunt
-void list_treasures(const char *hunt_id)
+// Function to print the treasures of a hunt, or of every hunt for "--all",
+// whose clues contain every word of query (ignoring case).
+// Returns a STATUS_ code.
+int search_treasures(const char *hunt_id, const char *query, FILE *out)
 {
-    // Clean hunt_id by removing spaces
-    char clean_hunt_id[MAX_STRING];
-    int j = 0;
-    for (int i = 0; hunt_id[i] != '\0'; i++)
+    PostingList terms[SEARCH_MAX_TERMS];
+    int term_count = 0;
+    const char *p = query, *word;
+    size_t length;
+    while (clue_next_word(&p, &word, &length))
     {
-        if (!isspace(hunt_id[i]))
+        if (term_count == SEARCH_MAX_TERMS)
         {
-            clean_hunt_id[j++] = hunt_id[i];
+            fprintf(out, "Too many search terms (at most %d)\n", SEARCH_MAX_TERMS);
+            return STATUS_BAD_REQUEST;
         }
+        terms[term_count].word = word;
+        terms[term_count].length = length;
+        terms[term_count].hash = clue_word_hash(word, length);
+        term_count++;
     }
-    clean_hunt_id[j] = '\0';
-
-    // printf("Debug: Attempting to list treasures for hunt: %s\n", clean_hunt_id);
-
-    char *file_path = get_treasure_file_path(clean_hunt_id);
-    // printf("Debug: Treasure file path: %s\n", file_path);
-
-    FILE *file = fopen(file_path, "rb");
-    if (file == NULL)
+    if (term_count == 0)
     {
-        // printf("Debug: Failed to open treasure file. Error: %s\n", strerror(errno));
-        printf("No treasures found in hunt: %s\n", clean_hunt_id);
-        return;
+        fprintf(out, "Please provide the words to search for.\n");
+        return STATUS_BAD_REQUEST;
     }
 
-    Hunt hunt;
-    if (fread(&hunt.treasure_count, sizeof(int), 1, file) != 1)
+    if (strcmp(hunt_id, "--all") != 0)
     {
-        printf("Debug: Failed to read treasure count\n");
-        fclose(file);
-        return;
+        return print_search(hunt_id, query, terms, term_count, 0, out) < 0 ? STATUS_ERROR : STATUS_OK;
     }
 
-    // printf("Debug: Found %d treasures\n", hunt.treasure_count);
-
-    if (hunt.treasure_count == 0)
+    CatalogEntry *entries;
+    int count = read_catalog(&entries);
+    if (count < 0)
     {
-        printf("No treasures found in hunt: %s\n", clean_hunt_id);
-        log_operation(clean_hunt_id, "LIST", "No treasures found");
-        return;
+        fprintf(out, "Error: Could not read the hunt catalog\n");
+        return STATUS_ERROR;
     }
-
-    // Read all treasures
-    if (fread(hunt.treasures, sizeof(Treasure), hunt.treasure_count, file) != hunt.treasure_count)
+    long found = 0;
+    int hunts = 0;
+    for (int i = 0; i < count; i++)
     {
-        printf("Debug: Failed to read treasures\n");
-        fclose(file);
-        return;
+        long matches = print_search(entries[i].hunt_id, query, terms, term_count, 1, out);
+        if (matches > 0)
+        {
+            found += matches;
+            hunts++;
+        }
     }
+    free(entries);
+    fprintf(out, "\nFound %ld treasures matching \"%s\" in %d hunts\n", found, query, hunts);
+    return STATUS_OK;
+}
 
-    struct stat st;
-    if (stat(file_path, &st) == 0)
+// Function to print the score table of a hunt, best top_k users first
+// (all users if top_k <= 0). The scores are read from scores.dat, which add
+// and remove keep up to date. Only a table missing or behind the cached
+// hunt is recomputed, and then saved for the next request.
+// Returns a STATUS_ code.
+int calculate_score(const char *hunt_id, int top_k, FILE *out)
+{
+    CachedHunt *hunt = acquire_hunt(hunt_id);
+    if (!hunt)
     {
-        printf("Hunt: %s\n", clean_hunt_id);
-        printf("File size: %ld bytes\n", st.st_size);
-        printf("Last modified: %s", ctime(&st.st_mtime));
-        printf("\nTreasures:\n");
+        fprintf(out, "Error: Could not open treasure file of hunt %s\n", hunt_id);
+        return STATUS_ERROR;
     }
 
-    for (int i = 0; i < hunt.treasure_count; i++)
+    ScoreFile file;
+    HuntScores *scores = &file.scores;
+    if (score_file_read(get_scores_file_path(hunt_id), &file) != 0 || !score_file_matches(&file.header, &hunt->view))
     {
-        Treasure *t = &hunt.treasures[i];
-        printf("\nID: %d\n", t->id);
-        printf("Username: %s\n", t->username);
-        printf("Location: %.4f, %.4f\n", t->latitude, t->longitude);
-        printf("Clue: %s\n", t->clue);
-        printf("Value: %d\n", t->value);
+        score_file_free(&file);
+        if (hunt_scores_compute(&hunt->view, scores) != 0)
+        {
+            fprintf(out, "Error: Out of memory\n");
+            release_hunt(hunt);
+            return STATUS_ERROR;
+        }
+
+        // Save the table unless the hunt changed since it was cached
+        int lock = lock_hunt(hunt_id);
+        struct stat st;
+        if (lock != -1 && stat(get_treasure_file_path(hunt_id), &st) == 0 && same_file_version(&st, &hunt->st))
+        {
+            ScoreSource source;
+            score_source_of_view(&hunt->view, &source);
+            save_scores(hunt_id, scores, &source);
+        }
+        if (lock != -1)
+        {
+            close(lock);
+        }
     }
 
-    fclose(file);
+    int ranked = hunt_scores_top(scores, top_k);
+    score_table_header(out, hunt_id);
+    for (int i = 0; i < ranked; i++)
+    {
+        score_table_row(out, scores->users[i].username, scores->users[i].total_score,
+                        scores->users[i].treasure_count);
+    }
+    score_table_footer(out);
 
-    char log_details[MAX_LOG_DETAILS];
-    snprintf(log_details, sizeof(log_details), "Listed %d treasures", hunt.treasure_count);
-    log_operation(clean_hunt_id, "LIST", log_details);
+    score_file_free(&file);
+    release_hunt(hunt);
+    return STATUS_OK;
 }
 
-// Function to view a specific treasure
-void view_treasure(const char *hunt_id, int treasure_id)
+// Function to run one monitor command, printing its output to out.
+// Returns the STATUS_ code of the response.
+int run_monitor_command(const char *command, FILE *out)
 {
-    Hunt *hunt = load_treasures(hunt_id);
+    char hunt_id[MAX_STRING];
+    int treasure_id;
 
-    for (int i = 0; i < hunt->treasure_count; i++)
+    if (strcmp(command, "list_hunts") == 0)
+    {
+        list_hunts(out);
+        return STATUS_OK;
+    }
+    if (strncmp(command, "list_treasures", 14) == 0)
     {
-        if (hunt->treasures[i].id == treasure_id)
+        if (sscanf(command + 14, "%511s", hunt_id) != 1)
         {
-            Treasure *t = &hunt->treasures[i];
-            printf("\nTreasure Details:\n");
-            printf("ID: %d\n", t->id);
-            printf("Username: %s\n", t->username);
-            printf("Location: %.6f, %.6f\n", t->latitude, t->longitude);
-            printf("Clue: %s\n", t->clue);
-            printf("Value: %d\n", t->value);
-
-            char log_details[MAX_LOG_DETAILS];
-            int written = snprintf(log_details, sizeof(log_details),
-                                   "Viewed treasure ID: %d, Username: %s",
-                                   t->id, t->username);
-
-            if (written >= sizeof(log_details))
-            {
-                // Truncate the username if needed
-                char truncated_username[MAX_STRING];
-                strncpy(truncated_username, t->username, sizeof(truncated_username) - 1);
-                truncated_username[sizeof(truncated_username) - 1] = '\0';
-
-                snprintf(log_details, sizeof(log_details),
-                         "Viewed treasure ID: %d, Username: %s",
-                         t->id, truncated_username);
-            }
-
-            log_operation(hunt_id, "VIEW", log_details);
-            return;
+            fprintf(out, "Usage: list_treasures <hunt_id>\n");
+            return STATUS_BAD_REQUEST;
         }
+        list_treasures(hunt_id, out);
+        return STATUS_OK;
     }
-
-    printf("Treasure with ID %d not found in hunt %s\n", treasure_id, hunt_id);
-    char log_details[MAX_LOG_DETAILS];
-    snprintf(log_details, sizeof(log_details), "Failed to view treasure ID: %d (not found)", treasure_id);
-    log_operation(hunt_id, "VIEW", log_details);
-}
-
-void remove_treasure(const char *hunt_id, int treasure_id)
-{
-    Hunt *hunt = load_treasures(hunt_id);
-
-    if (hunt->treasure_count == 0)
+    if (strncmp(command, "view_treasure", 13) == 0)
     {
-        printf("\nNo treasures to remove in hunt %s\n", hunt_id);
-        log_operation(hunt_id, "REMOVE", "Failed: No treasures found");
-        return;
+        if (sscanf(command + 13, "%511s %d", hunt_id, &treasure_id) != 2)
+        {
+            fprintf(out, "Usage: view_treasure <hunt_id> <treasure_id>\n");
+            return STATUS_BAD_REQUEST;
+        }
+        view_treasure(hunt_id, treasure_id, out);
+        return STATUS_OK;
     }
-
-    int found = 0;
-
-    for (int i = 0; i < hunt->treasure_count; i++)
+    if (strncmp(command, "near", 4) == 0 && isspace((unsigned char)command[4]))
     {
-        if (hunt->treasures[i].id == treasure_id)
+        double latitude, longitude, radius_m;
+        if (sscanf(command + 4, "%511s %lf %lf %lf", hunt_id, &latitude, &longitude, &radius_m) != 4)
         {
-            found = 1;
-
-            // Shift remaining treasures up
-            for (int j = i; j < hunt->treasure_count - 1; j++)
-            {
-                hunt->treasures[j] = hunt->treasures[j + 1];
-            }
-
-            hunt->treasure_count--;
-
-            // Reassign IDs to be sequential again
-            for (int k = 0; k < hunt->treasure_count; k++)
-            {
-                hunt->treasures[k].id = k + 1;
-            }
-
-            save_treasures(hunt_id, hunt);
-
-            char log_details[MAX_LOG_DETAILS];
-            snprintf(log_details, sizeof(log_details), "Removed treasure ID: %d. Remaining count: %d", treasure_id, hunt->treasure_count);
-            log_operation(hunt_id, "REMOVE", log_details);
-
-            printf("\nTreasure ID %d removed successfully.\n", treasure_id);
-            return;
+            fprintf(out, "Usage: near <hunt_id> <lat> <lon> <radius_m>\n");
+            return STATUS_BAD_REQUEST;
         }
+        return near_treasures(hunt_id, latitude, longitude, radius_m, out);
     }
-
-    if (!found)
+    if (strncmp(command, "bbox", 4) == 0 && isspace((unsigned char)command[4]))
     {
-        printf("\nTreasure ID %d not found in hunt %s\n", treasure_id, hunt_id);
-        char log_details[MAX_LOG_DETAILS];
-        snprintf(log_details, sizeof(log_details), "Failed to remove treasure ID: %d (not found)", treasure_id);
-        log_operation(hunt_id, "REMOVE", log_details);
+        double min_lat, min_lon, max_lat, max_lon;
+        if (sscanf(command + 4, "%511s %lf %lf %lf %lf", hunt_id, &min_lat, &min_lon, &max_lat, &max_lon) != 5)
+        {
+            fprintf(out, "Usage: bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>\n");
+            return STATUS_BAD_REQUEST;
+        }
+        return bbox_treasures(hunt_id, min_lat, min_lon, max_lat, max_lon, out);
     }
-}
-
-void remove_hunt(const char *hunt_id)
-{
-    char dir_path[MAX_STRING];
-    if (snprintf(dir_path, sizeof(dir_path), "hunt/hunt%s", hunt_id) >= sizeof(dir_path))
+    if (strncmp(command, "nearest", 7) == 0 && isspace((unsigned char)command[7]))
     {
-        fprintf(stderr, "Directory path truncated for hunt_id: %s\n", hunt_id);
-        return;
+        double latitude, longitude;
+        int k = NEAREST_DEFAULT;
+        if (sscanf(command + 7, "%511s %lf %lf %d", hunt_id, &latitude, &longitude, &k) < 3)
+        {
+            fprintf(out, "Usage: nearest <hunt_id> <lat> <lon> [k]\n");
+            return STATUS_BAD_REQUEST;
+        }
+        return nearest_treasures(hunt_id, latitude, longitude, k, out);
     }
-
-    DIR *dir = opendir(dir_path);
-    if (dir == NULL)
+    if (strncmp(command, "bench_distance", 14) == 0 && isspace((unsigned char)command[14]))
     {
-        perror("Failed to open hunt directory");
-        return;
+        int queries = BENCH_DEFAULT_QUERIES;
+        if (sscanf(command + 14, "%511s %d", hunt_id, &queries) < 1)
+        {
+            fprintf(out, "Usage: bench_distance <hunt_id> [queries]\n");
+            return STATUS_BAD_REQUEST;
+        }
+        return bench_distance(hunt_id, queries, out);
     }
-
-    struct dirent *entry;
-    char file_path[MAX_STRING];
-
-    // Remove all files in the hunt directory
-    while ((entry = readdir(dir)) != NULL)
+    if (strncmp(command, "search", 6) == 0 && isspace((unsigned char)command[6]))
     {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            continue;
-
-        if (snprintf(file_path, sizeof(file_path), "%s/%s", dir_path, entry->d_name) >= sizeof(file_path))
+        int query_start = 0;
+        if (sscanf(command + 6, "%511s %n", hunt_id, &query_start) != 1 || query_start == 0)
         {
-            fprintf(stderr, "File path truncated: %s\n", entry->d_name);
-            continue;
+            fprintf(out, "Usage: search <hunt_id|--all> <words>\n");
+            return STATUS_BAD_REQUEST;
         }
-
-        if (remove(file_path) != 0)
+        return search_treasures(hunt_id, command + 6 + query_start, out);
+    }
+    if (strncmp(command, "log", 3) == 0 && isspace((unsigned char)command[3]))
+    {
+        if (sscanf(command + 3, " dump %511s", hunt_id) != 1)
         {
-            perror("Error deleting file");
+            fprintf(out, "Usage: log dump <hunt_id|--all>\n");
+            return STATUS_BAD_REQUEST;
         }
+        return dump_hunt_log(hunt_id, out);
     }
-
-    closedir(dir);
-
-    // Remove the directory itself
-    if (rmdir(dir_path) != 0)
+    if (strncmp(command, "calculate_score", 15) == 0)
     {
-        perror("Failed to remove hunt directory");
-        return;
+        int top_k = 0;
+        if (sscanf(command + 15, "%511s %d", hunt_id, &top_k) < 1)
+        {
+            fprintf(out, "Usage: calculate_score <hunt_id> [top_k]\n");
+            return STATUS_BAD_REQUEST;
+        }
+        return calculate_score(hunt_id, top_k, out);
     }
 
-    // Remove the symlink to the hunt directory
-    char symlink_path[MAX_STRING];
-    if (snprintf(symlink_path, sizeof(symlink_path), "links_log_hunt/logged_hunt-%s", hunt_id) < sizeof(symlink_path))
+    fprintf(out, "Unknown monitor command: %s\n", command);
+    return STATUS_UNKNOWN_COMMAND;
+}
+
+// Function to run a request and send its response
+void handle_monitor_request(uint32_t request_id, const char *command)
+{
+    FILE *response = open_frame_stream(request_id);
+    if (!response)
     {
-        unlink(symlink_path); // Ignore errors if it doesn't exist
+        send_end(request_id, STATUS_ERROR, "Could not allocate response stream\n");
+        return;
     }
 
-    printf("\nHunt %s removed successfully.\n", hunt_id);
+    int status = run_monitor_command(command, response);
+    fclose(response); // Sends the last data frame
+    send_end(request_id, (uint16_t)status, NULL);
 }
 
-// Signal handler for SIGUSR1
-void handle_sigusr1(int signum)
+// Function run by each monitor worker: handle queued requests until the
+// queue is closed and empty
+void *monitor_worker(void *arg)
 {
-    command_ready = 1;
+    (void)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&monitor_queue.lock);
+        while (!monitor_queue.head && !monitor_queue.closing)
+        {
+            pthread_cond_wait(&monitor_queue.ready, &monitor_queue.lock);
+        }
+        MonitorJob *job = monitor_queue.head;
+        if (job)
+        {
+            monitor_queue.head = job->next;
+            if (!monitor_queue.head)
+            {
+                monitor_queue.tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&monitor_queue.lock);
+
+        if (!job)
+        {
+            return NULL;
+        }
+        handle_monitor_request(job->request_id, job->command);
+        free(job->command);
+        free(job);
+    }
 }
 
-void monitor_mode()
+// Function to queue a request for the workers. Returns 0 on success.
+int queue_monitor_request(uint32_t request_id, const char *command)
 {
-    // Set up signal handler
-    struct sigaction sa;
-    sa.sa_handler = handle_sigusr1;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if (sigaction(SIGUSR1, &sa, NULL) < 0)
+    MonitorJob *job = malloc(sizeof(MonitorJob));
+    if (!job || !(job->command = strdup(command)))
     {
-        perror("sigaction failed");
-        exit(1);
+        free(job);
+        return -1;
+    }
+    job->request_id = request_id;
+    job->next = NULL;
+
+    pthread_mutex_lock(&monitor_queue.lock);
+    if (monitor_queue.tail)
+    {
+        monitor_queue.tail->next = job;
     }
+    else
+    {
+        monitor_queue.head = job;
+    }
+    monitor_queue.tail = job;
+    pthread_cond_signal(&monitor_queue.ready);
+    pthread_mutex_unlock(&monitor_queue.lock);
+    return 0;
+}
 
+void monitor_mode()
+{
     // Ignore SIGTSTP (Ctrl+Z) to prevent stopping
     signal(SIGTSTP, SIG_IGN);
 
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
+    // The monitor is long-lived, keep hunts mapped between requests
+    hunt_cache_enabled = 1;
 
-    // Buffer for building response
-    FILE *stdout_pipe = fdopen(STDOUT_FILENO, "w");
-    if (!stdout_pipe)
+    // Responses are written to their own descriptor; stray output to
+    // fd 1 goes to stderr instead of breaking the framing
+    int request_fd = STDIN_FILENO;
+    monitor_queue.response_fd = dup(STDOUT_FILENO);
+    if (monitor_queue.response_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
     {
-        perror("Failed to open stdout pipe");
+        perror("Failed to set up response pipe");
         exit(1);
     }
-    setbuf(stdout_pipe, NULL); // Make the stream unbuffered
 
-    // Set stdin to non-blocking mode
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    char *payload = malloc(FRAME_MAX_PAYLOAD + 1);
+    if (!payload)
+    {
+        perror("Failed to allocate request buffer");
+        exit(1);
+    }
+
+    pthread_t workers[MONITOR_WORKERS];
+    int worker_count = 0;
+    while (worker_count < MONITOR_WORKERS &&
+           pthread_create(&workers[worker_count], NULL, monitor_worker, NULL) == 0)
+    {
+        worker_count++;
+    }
+    if (worker_count == 0)
+    {
+        perror("Failed to start monitor workers");
+        exit(1);
+    }
 
-    // Send initial ready message through pipe
-    fprintf(stdout_pipe, "Monitor mode started. Waiting for commands...\n");
-    fflush(stdout_pipe);
+    send_end(0, STATUS_OK, "Monitor mode started. Waiting for commands...\n");
 
+    FrameHeader header;
+    uint32_t stop_request_id = 0;
     while (running)
     {
-        // Wait for signal indicating command is ready
-        while (!command_ready && running)
+        // Requests are read as they arrive; end of file means the hub is gone
+        int result = frame_read(request_fd, &header, payload);
+        if (result == 0)
         {
-            pause();
-        }
-
-        if (!running)
             break;
-        command_ready = 0;
-
-        // Read command from stdin (pipe)
-        if ((read = getline(&line, &len, stdin)) == -1)
+        }
+        if (result < 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-                continue;
-            }
+            perror("Error reading request");
             break;
         }
 
-        // Remove newline
-        if (read > 0 && line[read - 1] == '\n')
+        if (header.type != FRAME_REQUEST)
         {
-            line[read - 1] = '\0';
+            send_end(header.request_id, STATUS_BAD_REQUEST, "Expected a request frame\n");
+            continue;
         }
 
-        if (strcmp(line, "stop") == 0)
+        if (strcmp(payload, "stop") == 0)
         {
             running = 0;
-            fprintf(stdout_pipe, "Monitor stopping...\n");
-            fflush(stdout_pipe);
-            kill(getppid(), SIGUSR1);
+            stop_request_id = header.request_id;
             break;
         }
 
-        // Process commands and write responses to pipe
-        if (strcmp(line, "list_hunts") == 0)
-        {
-            DIR *hunt_dir = opendir("hunt");
-            if (hunt_dir)
-            {
-                struct dirent *entry;
-                int found_hunts = 0;
-                while ((entry = readdir(hunt_dir)) != NULL)
-                {
-                    if (entry->d_type == DT_DIR && strncmp(entry->d_name, "hunt", 4) == 0)
-                    {
-                        char *hunt_id = entry->d_name + 4;
-                        Hunt *hunt = load_treasures(hunt_id);
-                        if (hunt)
-                        {
-                            fprintf(stdout_pipe, "Hunt %s: %d treasures\n", hunt_id, hunt->treasure_count);
-                            found_hunts = 1;
-                        }
-                    }
-                }
-                if (!found_hunts)
-                {
-                    fprintf(stdout_pipe, "No hunts found\n");
-                }
-                closedir(hunt_dir);
-            }
-            else
-            {
-                fprintf(stdout_pipe, "Error: Could not open hunt directory\n");
-            }
-            fflush(stdout_pipe);
-            kill(getppid(), SIGUSR1);
-        }
-        else if (strncmp(line, "list_treasures ", 14) == 0)
+        if (queue_monitor_request(header.request_id, payload) != 0)
         {
-            const char *hunt_id = line + 14;
-            // Redirect all printf output to the pipe
-            int stdout_fd = dup(STDOUT_FILENO);
-            dup2(fileno(stdout_pipe), STDOUT_FILENO);
-
-            // Call list_treasures
-            list_treasures(hunt_id);
-
-            // Restore original stdout
-            fflush(stdout);
-            dup2(stdout_fd, STDOUT_FILENO);
-            close(stdout_fd);
-
-            fflush(stdout_pipe);
-            kill(getppid(), SIGUSR1);
+            send_end(header.request_id, STATUS_ERROR, "Could not queue request\n");
         }
-        else if (strncmp(line, "view_treasure ", 13) == 0)
-        {
-            char hunt_id[512];
-            int treasure_id;
-            if (sscanf(line + 13, "%s %d", hunt_id, &treasure_id) == 2)
-            {
-                // Redirect all printf output to the pipe
-                int stdout_fd = dup(STDOUT_FILENO);
-                dup2(fileno(stdout_pipe), STDOUT_FILENO);
-
-                // Call view_treasure
-                view_treasure(hunt_id, treasure_id);
-
-                // Restore original stdout
-                fflush(stdout);
-                dup2(stdout_fd, STDOUT_FILENO);
-                close(stdout_fd);
+    }
 
-                fflush(stdout_pipe);
-                kill(getppid(), SIGUSR1);
-            }
-        }
+    // Requests already received are answered before the monitor exits
+    pthread_mutex_lock(&monitor_queue.lock);
+    monitor_queue.closing = 1;
+    pthread_cond_broadcast(&monitor_queue.ready);
+    pthread_mutex_unlock(&monitor_queue.lock);
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i], NULL);
     }
+    stop_log_writer(); // Everything the workers logged is on disk before the reply
 
-    if (line)
+    if (stop_request_id != 0)
     {
-        free(line);
+        send_end(stop_request_id, STATUS_OK, "Monitor stopping...\n");
     }
-    fclose(stdout_pipe);
+
+    free(payload);
+    close(monitor_queue.response_fd);
 }
 
 void display_commands()
 {
     printf("\nAvailable commands:\n");
     printf("  add <hunt_id> - Add a new treasure\n");
+    printf("  import <hunt_id> <file.csv|file.jsonl> - Add treasures from a file\n");
     printf("  list <hunt_id> - List all treasures\n");
+    printf("  export <hunt_id|--all> [--format csv|jsonl] - Write treasures to stdout\n");
     printf("  view <hunt_id> <treasure_id> - View specific treasure\n");
+    printf("  near <hunt_id> <lat> <lon> <radius_m> - Treasures within a distance\n");
+    printf("  bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon> - Treasures inside a box\n");
+    printf("  nearest <hunt_id> <lat> <lon> [k] - The k nearest treasures (default 10)\n");
+    printf("  search <hunt_id|--all> <words> - Treasures whose clue has every word\n");
+    printf("  bench_distance <hunt_id> [queries] - Time the distance kernels\n");
     printf("  remove <hunt_id> <treasure_id> - Remove a specific treasure\n");
     printf("  remove_hunt <hunt_id> - Remove a specific hunt\n");
+    printf("  compact <hunt_id> - Reclaim the space of removed treasures\n");
+    printf("  verify <hunt_id> - Check the stored scores against the treasures\n");
+    printf("  log dump <hunt_id|--all> - Print the operation log as text\n");
+    printf("  repair-links - Recreate the symlinks in links_log_hunt\n");
     printf("  exit - Exit the program\n");
     printf("\nEnter command: ");
 }
 
 int main(int argc, char *argv[])
 {
+    durability_init();
+    access_log_init();
+
     if (argc > 1 && strcmp(argv[1], "monitor") == 0)
     {
         monitor_mode();
@@ -828,6 +5378,13 @@ int main(int argc, char *argv[])
                     printf("Exiting Treasure Manager...\n");
                     break;
                 }
+                if (strcmp(command, "repair-links") == 0)
+                {
+                    flush_hunt_logs(); // Logs being created get their links first
+                    repair_log_links();
+                    display_commands();
+                    continue;
+                }
 
                 // Parse the command
                 char cmd[32], hunt_id[512];
@@ -840,14 +5397,41 @@ int main(int argc, char *argv[])
                         add_treasure(hunt_id);
                         display_commands(); // Only display commands after treasure is added
                     }
+                    else if (strcmp(cmd, "import") == 0)
+                    {
+                        char import_path[MAX_STRING];
+                        if (sscanf(command, "%*s %*s %511s", import_path) != 1)
+                        {
+                            printf("Please provide the file to import.\n");
+                        }
+                        else
+                        {
+                            import_treasures(hunt_id, import_path);
+                        }
+                        display_commands();
+                    }
+                    else if (strcmp(cmd, "export") == 0)
+                    {
+                        char format[16] = "csv";
+                        sscanf(command, "%*s %*s --format %15s", format);
+                        export_treasures(hunt_id, format);
+                        display_commands();
+                    }
+                    else if (strcmp(cmd, "near") == 0 || strcmp(cmd, "bbox") == 0 || strcmp(cmd, "nearest") == 0 ||
+                             strcmp(cmd, "bench_distance") == 0 || strcmp(cmd, "search") == 0 ||
+                             strcmp(cmd, "log") == 0)
+                    {
+                        run_monitor_command(command, stdout);
+                        display_commands();
+                    }
                     else if (strcmp(cmd, "list") == 0)
                     {
-                        list_treasures(hunt_id);
+                        list_treasures(hunt_id, stdout);
                         display_commands();
                     }
                     else if (strcmp(cmd, "view") == 0)
                     {
-                        view_treasure(hunt_id, treasure_id);
+                        view_treasure(hunt_id, treasure_id, stdout);
                         display_commands();
                     }
                     else if (strcmp(cmd, "remove") == 0)
@@ -867,6 +5451,16 @@ int main(int argc, char *argv[])
                         remove_hunt(hunt_id);
                         display_commands();
                     }
+                    else if (strcmp(cmd, "compact") == 0)
+                    {
+                        compact_hunt(hunt_id);
+                        display_commands();
+                    }
+                    else if (strcmp(cmd, "verify") == 0)
+                    {
+                        verify_scores(hunt_id);
+                        display_commands();
+                    }
                     else
                     {
                         printf("Unknown command: %s\n", cmd);
@@ -883,6 +5477,11 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    if (argc == 2 && strcmp(argv[1], "repair-links") == 0)
+    {
+        return repair_log_links() == 0 ? 0 : 1;
+    }
+
     if (argc < 3)
     {
         printf("Usage: %s <command> <hunt_id> [treasure_id]\n", argv[0]);
@@ -898,13 +5497,75 @@ int main(int argc, char *argv[])
     {
         add_treasure(hunt_id);
     }
+    else if (strcmp(command, "log") == 0)
+    {
+        if (argc != 4 || strcmp(argv[2], "dump") != 0)
+        {
+            printf("Usage: %s log dump <hunt_id|--all>\n", argv[0]);
+            return 1;
+        }
+        return dump_hunt_log(argv[3], stdout) == STATUS_OK ? 0 : 1;
+    }
+    else if (strcmp(command, "import") == 0)
+    {
+        if (argc < 4)
+        {
+            printf("Please provide the file to import.\n");
+            return 1;
+        }
+        return import_treasures(hunt_id, argv[3]) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "export") == 0)
+    {
+        const char *format = "csv";
+        if (argc > 3)
+        {
+            if (strcmp(argv[3], "--format") != 0 || argc != 5)
+            {
+                printf("Usage: %s export <hunt_id|--all> [--format csv|jsonl]\n", argv[0]);
+                return 1;
+            }
+            format = argv[4];
+        }
+        return export_treasures(hunt_id, format) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "near") == 0 && argc == 6)
+    {
+        return near_treasures(hunt_id, atof(argv[3]), atof(argv[4]), atof(argv[5]), stdout) == STATUS_OK ? 0 : 1;
+    }
+    else if (strcmp(command, "bbox") == 0 && argc == 7)
+    {
+        return bbox_treasures(hunt_id, atof(argv[3]), atof(argv[4]), atof(argv[5]), atof(argv[6]), stdout) == STATUS_OK
+                   ? 0
+                   : 1;
+    }
+    else if (strcmp(command, "nearest") == 0 && (argc == 5 || argc == 6))
+    {
+        int k = argc == 6 ? atoi(argv[5]) : NEAREST_DEFAULT;
+        return nearest_treasures(hunt_id, atof(argv[3]), atof(argv[4]), k, stdout) == STATUS_OK ? 0 : 1;
+    }
+    else if (strcmp(command, "search") == 0 && argc > 3)
+    {
+        char query[MAX_COMMAND] = "";
+        for (int i = 3; i < argc; i++)
+        {
+            size_t used = strlen(query);
+            snprintf(query + used, sizeof(query) - used, i > 3 ? " %s" : "%s", argv[i]);
+        }
+        return search_treasures(hunt_id, query, stdout) == STATUS_OK ? 0 : 1;
+    }
+    else if (strcmp(command, "bench_distance") == 0)
+    {
+        int queries = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_QUERIES;
+        return bench_distance(hunt_id, queries, stdout) == STATUS_OK ? 0 : 1;
+    }
     else if (strcmp(command, "list") == 0)
     {
-        list_treasures(hunt_id);
+        list_treasures(hunt_id, stdout);
     }
     else if (strcmp(command, "view") == 0)
     {
-        view_treasure(hunt_id, treasure_id);
+        view_treasure(hunt_id, treasure_id, stdout);
     }
     else if (strcmp(command, "remove") == 0)
     {
@@ -919,6 +5580,14 @@ int main(int argc, char *argv[])
     {
         remove_hunt(hunt_id);
     }
+    else if (strcmp(command, "compact") == 0)
+    {
+        return compact_hunt(hunt_id) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "verify") == 0)
+    {
+        return verify_scores(hunt_id) == 0 ? 0 : 1;
+    }
     else
     {
         printf("Unknown command: %s\n", command);
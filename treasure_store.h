@@ -0,0 +1,819 @@
+#ifndef TREASURE_STORE_H
+#define TREASURE_STORE_H
+
+// On-disk format of hunt/hunt<ID>/treasures.dat, shared by treasure_manager
+// (including monitor mode) and score_calculator.
+//
+// Version 3 layout (native byte order):
+//   header:  "TRSR" | uint32 version | uint32 record_count | uint32 live_count |
+//            uint32 next_id | uint32 reserved | uint64 data_end
+//   record:  int32 id | int32 value | double latitude | double longitude |
+//            uint16 username_len | uint16 clue_len | uint32 flags |
+//            username bytes + '\0' | clue bytes + '\0' | uint32 crc32
+// Records are only ever appended. A removed treasure keeps its record with
+// TREASURE_FLAG_DELETED set, so IDs never change; record_count includes
+// those tombstones, live_count does not. data_end is the committed end of
+// the records: bytes past it belong to an append that never finished. The
+// crc32 trailer covers the whole record except the flags word (which a
+// remove rewrites in place) and the trailer itself.
+//
+// Version 2 files have no data_end and no trailer, version 1 files also
+// have a 16 byte header (no live_count/next_id) and no flags field. Files
+// written before the format existed are a raw dump of "int count" followed
+// by count LegacyTreasure structs.
+//
+// treasures.idx, next to the data file, maps treasure IDs to record offsets:
+//   header:  "TRIX" | uint32 version | uint32 entry_count | uint32 reserved |
+//            uint64 data_inode | uint64 data_size
+//   entries: uint64 offset of the record with ID i + 1 (0 = no such treasure)
+// The inode and data_end (data_size) identify the treasures.dat contents the
+// index was built for, so a stale index is detected and ignored instead of trusted.
+//
+// hunt/catalog.dat lists every hunt with its totals, so listing hunts reads
+// one small file instead of every treasures.dat:
+//   header:  "TRCT" | uint32 version | uint32 entry_count | uint32 reserved
+//   entry:   uint32 live_count | uint32 id_len | int64 total_value |
+//            int64 modified (time_t) | hunt ID bytes (no terminator)
+// Entries are sorted by hunt ID. The catalog is rewritten whole on every
+// change; deleting it makes the next reader rebuild it from the hunts.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define MAX_STRING 512
+#define MAX_CLUE 1024
+
+#define TREASURE_MAGIC "TRSR"
+#define TREASURE_FORMAT_VERSION 3
+#define TREASURE_CHECKSUM_SIZE 4
+#define TREASURE_RECORD_FLAGS_OFFSET 28
+#define TREASURE_FLAG_DELETED 0x1
+#define TREASURE_INDEX_MAGIC "TRIX"
+#define TREASURE_INDEX_VERSION 1
+#define HUNT_CATALOG_MAGIC "TRCT"
+#define HUNT_CATALOG_VERSION 1
+
+#define HUNT_INITIAL_CAPACITY 16
+#define STRING_BLOCK_SIZE (64 * 1024)
+
+// Structure to hold treasure information. The strings point into storage
+// owned by the Hunt the treasure belongs to.
+typedef struct
+{
+    int id;
+    const char *username;
+    double latitude;
+    double longitude;
+    const char *clue;
+    int value;
+} Treasure;
+
+// Treasure layout used by the original raw-struct treasures.dat files
+typedef struct
+{
+    int id;
+    char username[MAX_STRING];
+    double latitude;
+    double longitude;
+    char clue[MAX_CLUE];
+    int value;
+} LegacyTreasure;
+
+// Chunk of the string arena used for strings added in memory
+typedef struct StringBlock
+{
+    struct StringBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} StringBlock;
+
+// Structure to hold hunt information. The treasure array grows geometrically;
+// strings loaded from disk stay in file_data and new ones go to the arena,
+// so no treasure ever needs an allocation of its own.
+typedef struct
+{
+    char hunt_id[MAX_STRING];
+    Treasure *treasures;
+    int treasure_count;
+    int treasure_capacity;
+    int next_id;
+    unsigned char *file_data;
+    StringBlock *strings;
+} Hunt;
+
+// File header at offset 0 of every versioned treasures.dat
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t live_count;
+    uint32_t next_id;
+    uint32_t reserved;
+    uint64_t data_end;
+} TreasureFileHeader;
+
+// Allocate an empty hunt
+static inline Hunt *hunt_create(const char *hunt_id)
+{
+    Hunt *hunt = calloc(1, sizeof(Hunt));
+    if (hunt)
+    {
+        strncpy(hunt->hunt_id, hunt_id, MAX_STRING - 1);
+    }
+    return hunt;
+}
+
+// Release a hunt together with its treasures and strings
+static inline void hunt_free(Hunt *hunt)
+{
+    if (!hunt)
+    {
+        return;
+    }
+
+    StringBlock *block = hunt->strings;
+    while (block)
+    {
+        StringBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(hunt->treasures);
+    free(hunt->file_data);
+    free(hunt);
+}
+
+// Make room for at least capacity treasures
+static inline int hunt_reserve(Hunt *hunt, int capacity)
+{
+    if (capacity <= hunt->treasure_capacity)
+    {
+        return 0;
+    }
+
+    int new_capacity = hunt->treasure_capacity ? hunt->treasure_capacity : HUNT_INITIAL_CAPACITY;
+    while (new_capacity < capacity)
+    {
+        new_capacity *= 2;
+    }
+
+    Treasure *treasures = realloc(hunt->treasures, (size_t)new_capacity * sizeof(Treasure));
+    if (!treasures)
+    {
+        return -1;
+    }
+    hunt->treasures = treasures;
+    hunt->treasure_capacity = new_capacity;
+    return 0;
+}
+
+// Append an uninitialized treasure slot, or return NULL if out of memory
+static inline Treasure *hunt_append(Hunt *hunt)
+{
+    if (hunt_reserve(hunt, hunt->treasure_count + 1) != 0)
+    {
+        return NULL;
+    }
+    return &hunt->treasures[hunt->treasure_count++];
+}
+
+// Copy a string into the hunt's arena
+static inline const char *hunt_strdup(Hunt *hunt, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    StringBlock *block = hunt->strings;
+
+    if (!block || block->size - block->used < len)
+    {
+        size_t size = len > STRING_BLOCK_SIZE ? len : STRING_BLOCK_SIZE;
+        block = malloc(sizeof(StringBlock) + size);
+        if (!block)
+        {
+            return NULL;
+        }
+        block->next = hunt->strings;
+        block->used = 0;
+        block->size = size;
+        hunt->strings = block;
+    }
+
+    char *copy = block->data + block->used;
+    memcpy(copy, s, len);
+    block->used += len;
+    return copy;
+}
+
+// Header of treasures.idx
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t data_inode;
+    uint64_t data_size;
+} TreasureIndexHeader;
+
+// Header of hunt/catalog.dat
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+} HuntCatalogHeader;
+
+// Fixed part of a catalog entry, followed by id_len bytes of hunt ID
+typedef struct
+{
+    uint32_t live_count;
+    uint32_t id_len;
+    int64_t total_value;
+    int64_t modified;
+} HuntCatalogRecord;
+
+// A hunt as listed in the catalog
+typedef struct
+{
+    char hunt_id[MAX_STRING];
+    int live_count;
+    long long total_value;
+    time_t modified;
+} CatalogEntry;
+
+// Lookup table of the reflected CRC-32 polynomial 0xEDB88320, constant so
+// threads never race to fill it
+static const uint32_t treasure_crc32_table[256] = {
+    0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu, 0x076DC419u, 0x706AF48Fu,
+    0xE963A535u, 0x9E6495A3u, 0x0EDB8832u, 0x79DCB8A4u, 0xE0D5E91Eu, 0x97D2D988u,
+    0x09B64C2Bu, 0x7EB17CBDu, 0xE7B82D07u, 0x90BF1D91u, 0x1DB71064u, 0x6AB020F2u,
+    0xF3B97148u, 0x84BE41DEu, 0x1ADAD47Du, 0x6DDDE4EBu, 0xF4D4B551u, 0x83D385C7u,
+    0x136C9856u, 0x646BA8C0u, 0xFD62F97Au, 0x8A65C9ECu, 0x14015C4Fu, 0x63066CD9u,
+    0xFA0F3D63u, 0x8D080DF5u, 0x3B6E20C8u, 0x4C69105Eu, 0xD56041E4u, 0xA2677172u,
+    0x3C03E4D1u, 0x4B04D447u, 0xD20D85FDu, 0xA50AB56Bu, 0x35B5A8FAu, 0x42B2986Cu,
+    0xDBBBC9D6u, 0xACBCF940u, 0x32D86CE3u, 0x45DF5C75u, 0xDCD60DCFu, 0xABD13D59u,
+    0x26D930ACu, 0x51DE003Au, 0xC8D75180u, 0xBFD06116u, 0x21B4F4B5u, 0x56B3C423u,
+    0xCFBA9599u, 0xB8BDA50Fu, 0x2802B89Eu, 0x5F058808u, 0xC60CD9B2u, 0xB10BE924u,
+    0x2F6F7C87u, 0x58684C11u, 0xC1611DABu, 0xB6662D3Du, 0x76DC4190u, 0x01DB7106u,
+    0x98D220BCu, 0xEFD5102Au, 0x71B18589u, 0x06B6B51Fu, 0x9FBFE4A5u, 0xE8B8D433u,
+    0x7807C9A2u, 0x0F00F934u, 0x9609A88Eu, 0xE10E9818u, 0x7F6A0DBBu, 0x086D3D2Du,
+    0x91646C97u, 0xE6635C01u, 0x6B6B51F4u, 0x1C6C6162u, 0x856530D8u, 0xF262004Eu,
+    0x6C0695EDu, 0x1B01A57Bu, 0x8208F4C1u, 0xF50FC457u, 0x65B0D9C6u, 0x12B7E950u,
+    0x8BBEB8EAu, 0xFCB9887Cu, 0x62DD1DDFu, 0x15DA2D49u, 0x8CD37CF3u, 0xFBD44C65u,
+    0x4DB26158u, 0x3AB551CEu, 0xA3BC0074u, 0xD4BB30E2u, 0x4ADFA541u, 0x3DD895D7u,
+    0xA4D1C46Du, 0xD3D6F4FBu, 0x4369E96Au, 0x346ED9FCu, 0xAD678846u, 0xDA60B8D0u,
+    0x44042D73u, 0x33031DE5u, 0xAA0A4C5Fu, 0xDD0D7CC9u, 0x5005713Cu, 0x270241AAu,
+    0xBE0B1010u, 0xC90C2086u, 0x5768B525u, 0x206F85B3u, 0xB966D409u, 0xCE61E49Fu,
+    0x5EDEF90Eu, 0x29D9C998u, 0xB0D09822u, 0xC7D7A8B4u, 0x59B33D17u, 0x2EB40D81u,
+    0xB7BD5C3Bu, 0xC0BA6CADu, 0xEDB88320u, 0x9ABFB3B6u, 0x03B6E20Cu, 0x74B1D29Au,
+    0xEAD54739u, 0x9DD277AFu, 0x04DB2615u, 0x73DC1683u, 0xE3630B12u, 0x94643B84u,
+    0x0D6D6A3Eu, 0x7A6A5AA8u, 0xE40ECF0Bu, 0x9309FF9Du, 0x0A00AE27u, 0x7D079EB1u,
+    0xF00F9344u, 0x8708A3D2u, 0x1E01F268u, 0x6906C2FEu, 0xF762575Du, 0x806567CBu,
+    0x196C3671u, 0x6E6B06E7u, 0xFED41B76u, 0x89D32BE0u, 0x10DA7A5Au, 0x67DD4ACCu,
+    0xF9B9DF6Fu, 0x8EBEEFF9u, 0x17B7BE43u, 0x60B08ED5u, 0xD6D6A3E8u, 0xA1D1937Eu,
+    0x38D8C2C4u, 0x4FDFF252u, 0xD1BB67F1u, 0xA6BC5767u, 0x3FB506DDu, 0x48B2364Bu,
+    0xD80D2BDAu, 0xAF0A1B4Cu, 0x36034AF6u, 0x41047A60u, 0xDF60EFC3u, 0xA867DF55u,
+    0x316E8EEFu, 0x4669BE79u, 0xCB61B38Cu, 0xBC66831Au, 0x256FD2A0u, 0x5268E236u,
+    0xCC0C7795u, 0xBB0B4703u, 0x220216B9u, 0x5505262Fu, 0xC5BA3BBEu, 0xB2BD0B28u,
+    0x2BB45A92u, 0x5CB36A04u, 0xC2D7FFA7u, 0xB5D0CF31u, 0x2CD99E8Bu, 0x5BDEAE1Du,
+    0x9B64C2B0u, 0xEC63F226u, 0x756AA39Cu, 0x026D930Au, 0x9C0906A9u, 0xEB0E363Fu,
+    0x72076785u, 0x05005713u, 0x95BF4A82u, 0xE2B87A14u, 0x7BB12BAEu, 0x0CB61B38u,
+    0x92D28E9Bu, 0xE5D5BE0Du, 0x7CDCEFB7u, 0x0BDBDF21u, 0x86D3D2D4u, 0xF1D4E242u,
+    0x68DDB3F8u, 0x1FDA836Eu, 0x81BE16CDu, 0xF6B9265Bu, 0x6FB077E1u, 0x18B74777u,
+    0x88085AE6u, 0xFF0F6A70u, 0x66063BCAu, 0x11010B5Cu, 0x8F659EFFu, 0xF862AE69u,
+    0x616BFFD3u, 0x166CCF45u, 0xA00AE278u, 0xD70DD2EEu, 0x4E048354u, 0x3903B3C2u,
+    0xA7672661u, 0xD06016F7u, 0x4969474Du, 0x3E6E77DBu, 0xAED16A4Au, 0xD9D65ADCu,
+    0x40DF0B66u, 0x37D83BF0u, 0xA9BCAE53u, 0xDEBB9EC5u, 0x47B2CF7Fu, 0x30B5FFE9u,
+    0xBDBDF21Cu, 0xCABAC28Au, 0x53B39330u, 0x24B4A3A6u, 0xBAD03605u, 0xCDD70693u,
+    0x54DE5729u, 0x23D967BFu, 0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u,
+    0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du
+};
+
+// CRC-32 (IEEE 802.3) of len bytes, continuing from crc
+static inline uint32_t treasure_crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = treasure_crc32_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Checksum of an encoded record of size bytes: everything but the flags and the trailer
+static inline uint32_t treasure_record_checksum(const unsigned char *record, size_t size)
+{
+    uint32_t crc = treasure_crc32(0, record, TREASURE_RECORD_FLAGS_OFFSET);
+    size_t strings = TREASURE_RECORD_FLAGS_OFFSET + 4;
+    return treasure_crc32(crc, record + strings, size - strings - TREASURE_CHECKSUM_SIZE);
+}
+
+// Size of the file header in a given format version
+static inline size_t treasure_header_size(uint32_t version)
+{
+    return version >= 2 ? sizeof(TreasureFileHeader) : 16;
+}
+
+// Size of the fixed-width part of a record in a given format version
+static inline size_t treasure_fixed_size(uint32_t version)
+{
+    return version >= 2 ? 32 : 28;
+}
+
+// Fill in a current-version header for a file of live treasures
+static inline void treasure_header_init(TreasureFileHeader *header, uint32_t record_count, uint32_t next_id,
+                                        uint64_t data_end)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TREASURE_MAGIC, 4);
+    header->version = TREASURE_FORMAT_VERSION;
+    header->record_count = record_count;
+    header->live_count = record_count;
+    header->next_id = next_id;
+    header->data_end = data_end;
+}
+
+// Parse the header at the start of a versioned file of len bytes. Older
+// versions get live_count = record_count, next_id = 0 (unknown) and
+// data_end = len. Returns 0 if the header is valid and of a supported version.
+static inline int treasure_header_parse(const unsigned char *buf, size_t len, TreasureFileHeader *header)
+{
+    if (len < 16 || memcmp(buf, TREASURE_MAGIC, 4) != 0)
+    {
+        return -1;
+    }
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header, buf, 16);
+    if (header->version < 1 || header->version > TREASURE_FORMAT_VERSION ||
+        len < treasure_header_size(header->version))
+    {
+        return -1;
+    }
+
+    if (header->version >= 2)
+    {
+        memcpy(header, buf, sizeof(*header));
+    }
+    else
+    {
+        header->live_count = header->record_count;
+        header->next_id = 0;
+    }
+
+    if (header->version < 3)
+    {
+        header->data_end = len;
+    }
+    else if (header->data_end < sizeof(*header) || header->data_end > len)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Number of bytes treasure_encode() will produce for a treasure
+static inline size_t treasure_encoded_size(const Treasure *t)
+{
+    return treasure_fixed_size(TREASURE_FORMAT_VERSION) + strlen(t->username) + 1 + strlen(t->clue) + 1 +
+           TREASURE_CHECKSUM_SIZE;
+}
+
+// Serialize one live treasure into out (which must hold treasure_encoded_size() bytes)
+static inline size_t treasure_encode(const Treasure *t, unsigned char *out)
+{
+    int32_t id = t->id;
+    int32_t value = t->value;
+    uint16_t username_len = (uint16_t)strlen(t->username);
+    uint16_t clue_len = (uint16_t)strlen(t->clue);
+    uint32_t flags = 0;
+    unsigned char *p = out;
+
+    memcpy(p, &id, 4);
+    memcpy(p + 4, &value, 4);
+    memcpy(p + 8, &t->latitude, 8);
+    memcpy(p + 16, &t->longitude, 8);
+    memcpy(p + 24, &username_len, 2);
+    memcpy(p + 26, &clue_len, 2);
+    memcpy(p + TREASURE_RECORD_FLAGS_OFFSET, &flags, 4);
+    p += treasure_fixed_size(TREASURE_FORMAT_VERSION);
+
+    memcpy(p, t->username, (size_t)username_len + 1);
+    p += username_len + 1;
+    memcpy(p, t->clue, (size_t)clue_len + 1);
+    p += clue_len + 1;
+
+    uint32_t checksum = treasure_record_checksum(out, (size_t)(p - out) + TREASURE_CHECKSUM_SIZE);
+    memcpy(p, &checksum, TREASURE_CHECKSUM_SIZE);
+    p += TREASURE_CHECKSUM_SIZE;
+
+    return (size_t)(p - out);
+}
+
+// Parse one record of the given format version from buf and store its flags.
+// Returns bytes consumed, or 0 if the record is malformed or fails its
+// checksum. The decoded strings point into buf, which must outlive the treasure.
+static inline size_t treasure_decode(const unsigned char *buf, size_t avail, uint32_t version,
+                                     Treasure *t, uint32_t *flags)
+{
+    size_t fixed_size = treasure_fixed_size(version);
+    if (avail < fixed_size)
+    {
+        return 0;
+    }
+
+    int32_t id, value;
+    uint16_t username_len, clue_len;
+    memcpy(&id, buf, 4);
+    memcpy(&value, buf + 4, 4);
+    memcpy(&t->latitude, buf + 8, 8);
+    memcpy(&t->longitude, buf + 16, 8);
+    memcpy(&username_len, buf + 24, 2);
+    memcpy(&clue_len, buf + 26, 2);
+    *flags = 0;
+    if (version >= 2)
+    {
+        memcpy(flags, buf + TREASURE_RECORD_FLAGS_OFFSET, 4);
+    }
+
+    size_t size = fixed_size + (size_t)username_len + 1 + (size_t)clue_len + 1;
+    if (version >= 3)
+    {
+        size += TREASURE_CHECKSUM_SIZE;
+    }
+    if (username_len >= MAX_STRING || clue_len >= MAX_CLUE || size > avail)
+    {
+        return 0;
+    }
+
+    const unsigned char *strings = buf + fixed_size;
+    if (strings[username_len] != '\0' || strings[username_len + 1 + clue_len] != '\0')
+    {
+        return 0;
+    }
+
+    if (version >= 3)
+    {
+        uint32_t checksum;
+        memcpy(&checksum, buf + size - TREASURE_CHECKSUM_SIZE, TREASURE_CHECKSUM_SIZE);
+        if (checksum != treasure_record_checksum(buf, size))
+        {
+            return 0;
+        }
+    }
+
+    t->id = id;
+    t->value = value;
+    t->username = (const char *)strings;
+    t->clue = (const char *)strings + username_len + 1;
+    return size;
+}
+
+// Parse one raw LegacyTreasure; returns 0 if its strings are not terminated.
+// The decoded strings point into old.
+static inline int treasure_decode_legacy(const unsigned char *old, Treasure *t)
+{
+    const char *username = (const char *)old + offsetof(LegacyTreasure, username);
+    const char *clue = (const char *)old + offsetof(LegacyTreasure, clue);
+    if (!memchr(username, '\0', MAX_STRING) || !memchr(clue, '\0', MAX_CLUE))
+    {
+        return 0;
+    }
+
+    memcpy(&t->id, old + offsetof(LegacyTreasure, id), sizeof(int));
+    memcpy(&t->latitude, old + offsetof(LegacyTreasure, latitude), sizeof(double));
+    memcpy(&t->longitude, old + offsetof(LegacyTreasure, longitude), sizeof(double));
+    memcpy(&t->value, old + offsetof(LegacyTreasure, value), sizeof(int));
+    t->username = username;
+    t->clue = clue;
+    return 1;
+}
+
+// Check whether a file starts with the versioned header
+static inline int treasure_file_is_versioned(const unsigned char *buf, size_t len)
+{
+    return len >= 4 && memcmp(buf, TREASURE_MAGIC, 4) == 0;
+}
+
+// Read the live treasures from an open treasures.dat (any format) into an
+// empty hunt. Sets *outdated when the file is not in the current format.
+// Returns 0 on success, -1 if the file is unreadable or corrupt.
+static inline int treasure_read_all(int fd, Hunt *hunt, int *outdated)
+{
+    struct stat st;
+    *outdated = 0;
+    hunt->next_id = 1;
+
+    if (fstat(fd, &st) != 0)
+    {
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        return 0;
+    }
+
+    unsigned char *data = malloc((size_t)st.st_size);
+    if (!data)
+    {
+        return -1;
+    }
+
+    size_t size = 0;
+    while (size < (size_t)st.st_size)
+    {
+        ssize_t n = pread(fd, data + size, (size_t)st.st_size - size, (off_t)size);
+        if (n <= 0)
+        {
+            break;
+        }
+        size += (size_t)n;
+    }
+
+    // The decoded strings point into data, so the hunt keeps it
+    hunt->file_data = data;
+
+    if (treasure_file_is_versioned(data, size))
+    {
+        TreasureFileHeader header;
+        if (treasure_header_parse(data, size, &header) != 0 ||
+            hunt_reserve(hunt, (int)header.live_count) != 0)
+        {
+            return -1;
+        }
+        *outdated = header.version != TREASURE_FORMAT_VERSION;
+        size = (size_t)header.data_end;
+
+        size_t offset = treasure_header_size(header.version);
+        int max_id = 0;
+        for (uint32_t i = 0; i < header.record_count; i++)
+        {
+            Treasure t;
+            uint32_t flags;
+            size_t used = treasure_decode(data + offset, size - offset, header.version, &t, &flags);
+            if (used == 0)
+            {
+                return -1;
+            }
+            offset += used;
+            max_id = t.id > max_id ? t.id : max_id;
+            if (!(flags & TREASURE_FLAG_DELETED))
+            {
+                Treasure *slot = hunt_append(hunt);
+                if (!slot)
+                {
+                    return -1;
+                }
+                *slot = t;
+            }
+        }
+
+        // Removed IDs are never handed out again
+        hunt->next_id = header.next_id > (uint32_t)max_id ? (int)header.next_id : max_id + 1;
+        return 0;
+    }
+
+    if (size < sizeof(int))
+    {
+        return -1;
+    }
+
+    int legacy_count;
+    memcpy(&legacy_count, data, sizeof(int));
+    if (legacy_count < 0 ||
+        size < sizeof(int) + (size_t)legacy_count * sizeof(LegacyTreasure) ||
+        hunt_reserve(hunt, legacy_count) != 0)
+    {
+        return -1;
+    }
+
+    *outdated = 1;
+    for (int i = 0; i < legacy_count; i++)
+    {
+        unsigned char *old = data + sizeof(int) + (size_t)i * sizeof(LegacyTreasure);
+        Treasure *t = &hunt->treasures[hunt->treasure_count++];
+        old[offsetof(LegacyTreasure, username) + MAX_STRING - 1] = '\0';
+        old[offsetof(LegacyTreasure, clue) + MAX_CLUE - 1] = '\0';
+        treasure_decode_legacy(old, t);
+        hunt->next_id = t->id >= hunt->next_id ? t->id + 1 : hunt->next_id;
+    }
+    return 0;
+}
+
+// Read-only, memory-mapped view of a treasures.dat. Records are decoded in
+// place, so iterating never copies the file and only touches the pages
+// that are actually read. Deleted records are skipped.
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;     // Committed bytes (data_end)
+    size_t map_size; // Bytes mapped
+    uint64_t inode;
+    uint32_t version;
+    int record_count;
+    int live_count;
+    int legacy;
+} TreasureView;
+
+// Map a treasures.dat read-only. Returns 0 on success (an empty file gives
+// an empty view), -1 if the file is missing or not a treasure file.
+// Appends write their records before the header, so the header is read
+// first and the size taken after it: data_end then never lies past the
+// mapping, even while an append runs without the hunt lock held.
+static inline int treasure_view_open(const char *path, TreasureView *view)
+{
+    memset(view, 0, sizeof(*view));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    unsigned char head[sizeof(TreasureFileHeader)];
+    ssize_t head_length = pread(fd, head, sizeof(head), 0);
+    struct stat st;
+    if (head_length < 0 || fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        view->inode = (uint64_t)st.st_ino;
+        return 0;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    view->data = data;
+    view->size = (size_t)st.st_size;
+    view->map_size = (size_t)st.st_size;
+    view->inode = (uint64_t)st.st_ino;
+
+    if (treasure_file_is_versioned(head, (size_t)head_length))
+    {
+        // The snapshot is parsed, not the live mapping an append may be
+        // rewriting; a short read means the file is shorter than a header
+        TreasureFileHeader header;
+        if (((size_t)head_length == sizeof(head) || (size_t)head_length >= view->map_size) &&
+            treasure_header_parse(head, view->map_size, &header) == 0)
+        {
+            view->version = header.version;
+            view->size = (size_t)header.data_end;
+            view->record_count = (int)header.record_count;
+            view->live_count = (int)header.live_count;
+            return 0;
+        }
+    }
+    else if (view->size >= sizeof(int))
+    {
+        int legacy_count;
+        memcpy(&legacy_count, view->data, sizeof(int));
+        if (legacy_count >= 0 &&
+            view->size >= sizeof(int) + (size_t)legacy_count * sizeof(LegacyTreasure))
+        {
+            view->record_count = legacy_count;
+            view->live_count = legacy_count;
+            view->legacy = 1;
+            return 0;
+        }
+    }
+
+    munmap((void *)view->data, view->map_size);
+    memset(view, 0, sizeof(*view));
+    return -1;
+}
+
+// Unmap a view opened with treasure_view_open()
+static inline void treasure_view_close(TreasureView *view)
+{
+    if (view->data)
+    {
+        munmap((void *)view->data, view->map_size);
+    }
+    memset(view, 0, sizeof(*view));
+}
+
+// Position of the next record while iterating a view
+typedef struct
+{
+    size_t offset;        // Where the next record starts
+    size_t record_offset; // Where the record last returned starts
+    int index;
+} TreasureCursor;
+
+// Start iterating a view from its first record
+static inline void treasure_cursor_init(const TreasureView *view, TreasureCursor *cursor)
+{
+    cursor->offset = view->legacy ? sizeof(int) : treasure_header_size(view->version);
+    cursor->record_offset = 0;
+    cursor->index = 0;
+}
+
+// Decode the next live record in place. Returns 1 if t was filled, 0 at the
+// end of the view or at the first corrupt record.
+static inline int treasure_view_next(const TreasureView *view, TreasureCursor *cursor, Treasure *t)
+{
+    while (cursor->index < view->record_count)
+    {
+        uint32_t flags = 0;
+        cursor->record_offset = cursor->offset;
+
+        if (view->legacy)
+        {
+            if (!treasure_decode_legacy(view->data + cursor->offset, t))
+            {
+                return 0;
+            }
+            cursor->offset += sizeof(LegacyTreasure);
+        }
+        else
+        {
+            size_t used = treasure_decode(view->data + cursor->offset, view->size - cursor->offset,
+                                          view->version, t, &flags);
+            if (used == 0)
+            {
+                return 0;
+            }
+            cursor->offset += used;
+        }
+
+        cursor->index++;
+        if (!(flags & TREASURE_FLAG_DELETED))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Decode the live record stored at offset in a versioned view.
+// Returns 1 if t was filled, 0 if offset does not hold a live record.
+static inline int treasure_view_get(const TreasureView *view, uint64_t offset, Treasure *t)
+{
+    uint32_t flags;
+    if (view->legacy || offset < treasure_header_size(view->version) || offset >= view->size)
+    {
+        return 0;
+    }
+    return treasure_decode(view->data + offset, view->size - (size_t)offset, view->version, t, &flags) != 0 &&
+           !(flags & TREASURE_FLAG_DELETED);
+}
+
+// Look up the record offset of a treasure ID in treasures.idx.
+// Returns 1 and sets *offset if the ID exists, 0 if the index says it does not,
+// and -1 if the index is missing or was not built for the mapped data file.
+static inline int treasure_index_lookup(const char *index_path, const TreasureView *view, int id, uint64_t *offset)
+{
+    int fd = open(index_path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    TreasureIndexHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, TREASURE_INDEX_MAGIC, 4) != 0 ||
+        header.version != TREASURE_INDEX_VERSION ||
+        header.data_inode != view->inode || header.data_size != view->size)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (id <= 0 || (uint32_t)id > header.entry_count)
+    {
+        close(fd);
+        return 0;
+    }
+
+    uint64_t entry;
+    off_t entry_offset = (off_t)(sizeof(header) + (size_t)(id - 1) * sizeof(entry));
+    ssize_t n = pread(fd, &entry, sizeof(entry), entry_offset);
+    close(fd);
+    if (n != (ssize_t)sizeof(entry))
+    {
+        return -1;
+    }
+
+    *offset = entry;
+    return entry != 0;
+}
+
+#endif